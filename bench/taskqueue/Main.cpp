@@ -0,0 +1,139 @@
+/*
+* Vool - task_queue benchmarks, lock policies and task submission under contention
+*
+* Copyright (c) 2016 Lukas Bergdoll - www.lukas-bergdoll.net
+*
+* This code is licensed under the Apache License 2.0 (https://opensource.org/licenses/Apache-2.0)
+*/
+
+#include <TaskQueue.h>
+#include <TestSuit.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+
+namespace vool
+{
+
+namespace bench
+{
+
+// results are written into this, so the compiler can not drop the critical sections
+volatile size_t sink;
+
+constexpr size_t acquisitions_per_thread = 10000;
+constexpr size_t tasks_per_thread = 1000;
+
+template<typename Func> void run_threads(const size_t thread_count, Func func)
+{
+	std::vector<std::thread> threads;
+	threads.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; ++i)
+		threads.emplace_back(func);
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// --- workloads ---
+
+// every thread takes the lock over and over for a tiny critical section,
+// the test size is the amount of competing threads
+template<typename Lock> auto make_lock_test(const char* name)
+{
+	return make_test(name, [](const size_t thread_count)
+	{
+		Lock lock;
+		size_t counter = 0;
+
+		run_threads(thread_count, [&lock, &counter]()
+		{
+			for (size_t i = 0; i < acquisitions_per_thread; ++i)
+			{
+				std::lock_guard<Lock> guard(lock);
+				++counter;
+			}
+		});
+
+		sink = counter;
+	});
+}
+
+// every thread submits empty tasks to one shared queue
+auto make_submission_test(const char* name)
+{
+	auto tq = std::make_shared<task_queue>();
+	return make_test(name, [tq](const size_t thread_count)
+	{
+		run_threads(thread_count, [&tq]()
+		{
+			for (size_t i = 0; i < tasks_per_thread; ++i)
+				tq->add_task([]() {});
+		});
+
+		tq->wait_all();
+	});
+}
+
+// the same tasks, every thread submits them with one add_tasks call
+auto make_batch_submission_test(const char* name)
+{
+	auto tq = std::make_shared<task_queue>();
+	return make_test(name, [tq](const size_t thread_count)
+	{
+		run_threads(thread_count, [&tq]()
+		{
+			tq->add_tasks(std::vector<std::function<void()>>(tasks_per_thread, []() {}));
+		});
+
+		tq->wait_all();
+	});
+}
+
+}
+
+}
+
+// usage: taskqueue_bench [max threads] [gnuplot path] [csv output file]
+int main(int argc, char* argv[])
+{
+	using namespace vool;
+	using namespace vool::bench;
+
+	size_t max_threads = argc > 1 ? std::stoull(argv[1]) : 64;
+
+	suit_config config;
+	config.filename = "TaskQueueBench_";
+	config.steps = 8;
+	if (argc > 2)
+		config.gnuplot_path = argv[2];
+
+	const char* csv_path = argc > 3 ? argv[3] : "taskqueue_bench.csv";
+
+	auto suit = make_test_suit(config,
+		make_test_category("lock_contention",
+			make_lock_test<task_queue_util::spin_lock<task_queue_util::yield_backoff>>("test_and_set"),
+			make_lock_test<task_queue_util::spin_lock<task_queue_util::exponential_backoff>>("exponential_backoff"),
+			make_lock_test<task_queue_util::ticket_lock>("ticket_lock"),
+			make_lock_test<std::mutex>("std::mutex")
+		),
+		make_test_category("add_task_contention",
+			make_submission_test("task_queue"),
+			make_batch_submission_test("task_queue_batch")
+		)
+	);
+
+	suit.perform_categorys(1, max_threads);
+
+	std::ofstream csv(csv_path);
+	suit.write_results(csv);
+	suit.render_results();
+
+	std::cout << "results written to " << csv_path << "\n";
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+* Vool - Minimal open addressing hash map, reference point for the vec_map benchmarks
+*
+* Copyright (c) 2016 Lukas Bergdoll - www.lukas-bergdoll.net
+*
+* This code is licensed under the Apache License 2.0 (https://opensource.org/licenses/Apache-2.0)
+*/
+
+#ifndef VOOL_BENCH_FLATHASHMAP_H_INCLUDED
+#define VOOL_BENCH_FLATHASHMAP_H_INCLUDED
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+namespace vool
+{
+
+namespace bench
+{
+
+// linear probing, power of two capacity, tombstones on erase
+template<typename K, typename V, typename Hash = std::hash<K>> class flat_hash_map
+{
+public:
+	explicit flat_hash_map() : _size(0), _used(0) { }
+
+	void reserve(const size_t);
+
+	void insert(const K&, const V&);
+
+	V* find(const K&);
+
+	void erase(const K&);
+
+	template<typename Func> void for_each(Func) const;
+
+	size_t size() const { return _size; }
+
+private:
+	enum class slot_state : uint8_t { empty, full, deleted };
+
+	struct slot
+	{
+		slot_state state = slot_state::empty;
+		K key;
+		V value;
+	};
+
+	std::vector<slot> _slots;
+	size_t _size; // full slots
+	size_t _used; // full and deleted slots
+
+	size_t mask() const { return _slots.size() - 1; }
+
+	size_t find_index(const K&) const; // _slots.size() if key is not present
+
+	void rehash(const size_t);
+};
+
+// ----- IMPLEMENTATION -----
+
+template<typename K, typename V, typename H> void flat_hash_map<K, V, H>::reserve(
+	const size_t count
+)
+{
+	if (count * 2 > _slots.size())
+		rehash(count * 2);
+}
+
+template<typename K, typename V, typename H> void flat_hash_map<K, V, H>::rehash(
+	const size_t min_capacity
+)
+{
+	size_t capacity = 8;
+	while (capacity < min_capacity)
+		capacity *= 2;
+
+	std::vector<slot> old(capacity);
+	old.swap(_slots);
+	_size = 0;
+	_used = 0;
+
+	for (auto& s : old)
+		if (s.state == slot_state::full)
+			insert(s.key, s.value);
+}
+
+template<typename K, typename V, typename H> void flat_hash_map<K, V, H>::insert(
+	const K& key,
+	const V& value
+)
+{
+	// keep load factor including tombstones below 0.5, rehashing also drops tombstones
+	if ((_used + 1) * 2 > _slots.size())
+		rehash((_size + 1) * 4);
+
+	size_t index = H()(key) & mask();
+	size_t tombstone = _slots.size();
+	while (_slots[index].state != slot_state::empty)
+	{
+		if (_slots[index].state == slot_state::full && _slots[index].key == key)
+		{
+			_slots[index].value = value;
+			return;
+		}
+		if (_slots[index].state == slot_state::deleted && tombstone == _slots.size())
+			tombstone = index;
+		index = (index + 1) & mask();
+	}
+
+	if (tombstone != _slots.size())
+		index = tombstone;
+	else
+		++_used;
+
+	_slots[index].state = slot_state::full;
+	_slots[index].key = key;
+	_slots[index].value = value;
+	++_size;
+}
+
+template<typename K, typename V, typename H> size_t flat_hash_map<K, V, H>::find_index(
+	const K& key
+) const
+{
+	if (_slots.empty())
+		return 0;
+
+	for (size_t index = H()(key) & mask();
+		_slots[index].state != slot_state::empty;
+		index = (index + 1) & mask())
+	{
+		if (_slots[index].state == slot_state::full && _slots[index].key == key)
+			return index;
+	}
+	return _slots.size();
+}
+
+template<typename K, typename V, typename H> V* flat_hash_map<K, V, H>::find(
+	const K& key
+)
+{
+	auto index = find_index(key);
+	return index != _slots.size() ? &_slots[index].value : nullptr;
+}
+
+template<typename K, typename V, typename H> void flat_hash_map<K, V, H>::erase(
+	const K& key
+)
+{
+	auto index = find_index(key);
+	if (index != _slots.size())
+	{
+		_slots[index].state = slot_state::deleted;
+		--_size;
+	}
+}
+
+template<typename K, typename V, typename H> template<typename Func>
+void flat_hash_map<K, V, H>::for_each(Func func) const
+{
+	for (const auto& s : _slots)
+		if (s.state == slot_state::full)
+			func(s.key, s.value);
+}
+
+}
+
+}
+
+#endif // VOOL_BENCH_FLATHASHMAP_H_INCLUDED
\ No newline at end of file
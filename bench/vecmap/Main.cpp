@@ -0,0 +1,347 @@
+/*
+* Vool - vec_map benchmarks against std::map, std::unordered_map and an open addressing map
+*
+* Copyright (c) 2016 Lukas Bergdoll - www.lukas-bergdoll.net
+*
+* This code is licensed under the Apache License 2.0 (https://opensource.org/licenses/Apache-2.0)
+*/
+
+#include "FlatHashMap.h"
+
+#include <Vecmap.h>
+#include <TestSuit.h>
+
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <limits>
+
+namespace vool
+{
+
+namespace bench
+{
+
+using value_t = size_t;
+
+// results are summed into this, so the compiler can not drop the lookups
+volatile value_t sink;
+
+// --- key generation ---
+
+template<typename K> K make_key(const uint64_t);
+
+template<> size_t make_key<size_t>(const uint64_t raw)
+{
+	return static_cast<size_t>(raw);
+}
+
+template<> std::string make_key<std::string>(const uint64_t raw)
+{
+	return "vool_bench_key_" + std::to_string(raw);
+}
+
+template<typename K> class fixture
+{
+public:
+	std::vector<K> keys; // present keys, random order
+	std::vector<K> missing_keys; // never inserted
+
+	fixture() : _size(std::numeric_limits<size_t>::max()) { }
+
+	void prepare(const size_t size)
+	{
+		if (size == _size)
+			return;
+
+		ContainerConfig<uint64_t> config;
+		config.size = size;
+		config.upper_bound = std::numeric_limits<uint32_t>::max();
+		auto raw = generate_container(config);
+
+		keys.clear();
+		missing_keys.clear();
+		for (const auto r : raw)
+		{
+			keys.push_back(make_key<K>(r * 2));
+			missing_keys.push_back(make_key<K>(r * 2 + 1));
+		}
+		_size = size;
+	}
+
+private:
+	size_t _size;
+};
+
+// --- uniform container access ---
+
+template<typename M, typename K> void insert_kv(M& map, const K& key, const value_t value)
+{
+	map.emplace(key, value);
+}
+
+template<typename K> void insert_kv(vec_map<K, value_t>& map, const K& key, const value_t value)
+{
+	map.insert(key, value);
+}
+
+template<typename K> void insert_kv(hash_vec_map<K, value_t>& map, const K& key, const value_t value)
+{
+	map.insert(key, value);
+}
+
+template<typename K> void insert_kv(flat_hash_map<K, value_t>& map, const K& key, const value_t value)
+{
+	map.insert(key, value);
+}
+
+template<typename M, typename K> const value_t* find_value(M& map, const K& key)
+{
+	auto it = map.find(key);
+	return it != map.end() ? &it->second : nullptr;
+}
+
+template<typename K> const value_t* find_value(vec_map<K, value_t>& map, const K& key)
+{
+	auto it = map.find(key);
+	return it != map.end() ? &it->value() : nullptr;
+}
+
+template<typename K> const value_t* find_value(hash_vec_map<K, value_t>& map, const K& key)
+{
+	auto it = map.find(key);
+	return it != map.end() ? &it->value() : nullptr;
+}
+
+template<typename K> const value_t* find_value(flat_hash_map<K, value_t>& map, const K& key)
+{
+	return map.find(key);
+}
+
+template<typename M> value_t sum_values(M& map)
+{
+	value_t sum = {};
+	for (const auto& kv : map)
+		sum += kv.second;
+	return sum;
+}
+
+template<typename K> value_t sum_values(vec_map<K, value_t>& map)
+{
+	value_t sum = {};
+	for (const auto& bucket : map)
+		sum += bucket.value();
+	return sum;
+}
+
+template<typename K> value_t sum_values(hash_vec_map<K, value_t>& map)
+{
+	value_t sum = {};
+	for (const auto& bucket : map)
+		sum += bucket.value();
+	return sum;
+}
+
+template<typename K> value_t sum_values(flat_hash_map<K, value_t>& map)
+{
+	value_t sum = {};
+	map.for_each([&sum](const K&, const value_t value) { sum += value; });
+	return sum;
+}
+
+template<typename M> void finish_build(M&) { }
+
+template<typename K> void finish_build(vec_map<K, value_t>& map)
+{
+	map.sort(); // a vec_map is only usable once sorted
+}
+
+template<typename M, typename K> void build(M& map, const std::vector<K>& keys)
+{
+	value_t value = {};
+	for (const auto& key : keys)
+		insert_kv(map, key, value++);
+	finish_build(map);
+}
+
+// --- workloads ---
+
+template<typename M, typename K> auto make_build_test(const char* name, fixture<K>& fix)
+{
+	auto map = std::make_shared<M>();
+	return make_test(name,
+		[&fix, map](const size_t) { build(*map, fix.keys); },
+		[&fix, map](const size_t size) { fix.prepare(size); *map = M(); }
+	);
+}
+
+template<typename M, typename K> auto make_lookup_test(
+	const char* name,
+	fixture<K>& fix,
+	const bool hit
+)
+{
+	auto map = std::make_shared<M>();
+	return make_test(name,
+		[&fix, map, hit](const size_t)
+		{
+			value_t sum = {};
+			for (const auto& key : hit ? fix.keys : fix.missing_keys)
+				if (auto value = find_value(*map, key))
+					sum += *value;
+			sink = sum;
+		},
+		[&fix, map](const size_t size) { fix.prepare(size); *map = M(); build(*map, fix.keys); }
+	);
+}
+
+template<typename M, typename K> auto make_iteration_test(const char* name, fixture<K>& fix)
+{
+	auto map = std::make_shared<M>();
+	return make_test(name,
+		[map](const size_t) { sink = sum_values(*map); },
+		[&fix, map](const size_t size) { fix.prepare(size); *map = M(); build(*map, fix.keys); }
+	);
+}
+
+template<typename M, typename K> auto make_erase_test(const char* name, fixture<K>& fix)
+{
+	// erase every 8th key one by one
+	auto map = std::make_shared<M>();
+	return make_test(name,
+		[&fix, map](const size_t)
+		{
+			for (size_t i = 0; i < fix.keys.size(); i += 8)
+				map->erase(fix.keys[i]);
+		},
+		[&fix, map](const size_t size) { fix.prepare(size); *map = M(); build(*map, fix.keys); }
+	);
+}
+
+template<typename M, typename K> auto make_mixed_test(const char* name, fixture<K>& fix)
+{
+	// interleaved insert and lookup, the worst case for lazy sorting
+	constexpr size_t rounds = 64;
+
+	auto map = std::make_shared<M>();
+	return make_test(name,
+		[&fix, map](const size_t)
+		{
+			value_t sum = {};
+			for (size_t i = 0; i < rounds && i < fix.keys.size(); ++i)
+			{
+				insert_kv(*map, fix.missing_keys[i], i);
+				if (auto value = find_value(*map, fix.keys[i]))
+					sum += *value;
+			}
+			sink = sum;
+		},
+		[&fix, map](const size_t size) { fix.prepare(size); *map = M(); build(*map, fix.keys); }
+	);
+}
+
+template<typename K> auto make_categorys(fixture<K>& fix, const std::string& key_name)
+{
+	using vec_map_t = vec_map<K, value_t>;
+	using hash_vec_map_t = hash_vec_map<K, value_t>;
+	using map_t = std::map<K, value_t>;
+	using unordered_map_t = std::unordered_map<K, value_t>;
+	using flat_map_t = flat_hash_map<K, value_t>;
+
+	return std::make_tuple(
+		make_test_category("build_" + key_name,
+			make_build_test<vec_map_t>("vec_map", fix),
+			make_build_test<hash_vec_map_t>("hash_vec_map", fix),
+			make_build_test<map_t>("std::map", fix),
+			make_build_test<unordered_map_t>("std::unordered_map", fix),
+			make_build_test<flat_map_t>("flat_hash_map", fix)
+		),
+		make_test_category("lookup_hit_" + key_name,
+			make_lookup_test<vec_map_t>("vec_map", fix, true),
+			make_lookup_test<hash_vec_map_t>("hash_vec_map", fix, true),
+			make_lookup_test<map_t>("std::map", fix, true),
+			make_lookup_test<unordered_map_t>("std::unordered_map", fix, true),
+			make_lookup_test<flat_map_t>("flat_hash_map", fix, true)
+		),
+		make_test_category("lookup_miss_" + key_name,
+			make_lookup_test<vec_map_t>("vec_map", fix, false),
+			make_lookup_test<hash_vec_map_t>("hash_vec_map", fix, false),
+			make_lookup_test<map_t>("std::map", fix, false),
+			make_lookup_test<unordered_map_t>("std::unordered_map", fix, false),
+			make_lookup_test<flat_map_t>("flat_hash_map", fix, false)
+		),
+		make_test_category("iteration_" + key_name,
+			make_iteration_test<vec_map_t>("vec_map", fix),
+			make_iteration_test<hash_vec_map_t>("hash_vec_map", fix),
+			make_iteration_test<map_t>("std::map", fix),
+			make_iteration_test<unordered_map_t>("std::unordered_map", fix),
+			make_iteration_test<flat_map_t>("flat_hash_map", fix)
+		),
+		make_test_category("erase_" + key_name,
+			make_erase_test<vec_map_t>("vec_map", fix),
+			make_erase_test<hash_vec_map_t>("hash_vec_map", fix),
+			make_erase_test<map_t>("std::map", fix),
+			make_erase_test<unordered_map_t>("std::unordered_map", fix),
+			make_erase_test<flat_map_t>("flat_hash_map", fix)
+		),
+		make_test_category("mixed_" + key_name,
+			make_mixed_test<vec_map_t>("vec_map", fix),
+			make_mixed_test<hash_vec_map_t>("hash_vec_map", fix),
+			make_mixed_test<map_t>("std::map", fix),
+			make_mixed_test<unordered_map_t>("std::unordered_map", fix),
+			make_mixed_test<flat_map_t>("flat_hash_map", fix)
+		)
+	);
+}
+
+template<typename Categorys, std::size_t... Is> auto make_suit(
+	const suit_config& config,
+	Categorys&& categorys,
+	std::index_sequence<Is...>
+)
+{
+	return make_test_suit(config, std::move(std::get<Is>(categorys))...);
+}
+
+}
+
+}
+
+// usage: vecmap_bench [max size] [gnuplot path] [csv output file]
+int main(int argc, char* argv[])
+{
+	using namespace vool::bench;
+
+	size_t max_size = argc > 1 ? std::stoull(argv[1]) : 100000;
+
+	vool::suit_config config;
+	config.filename = "VecmapBench_";
+	config.steps = 10;
+	if (argc > 2)
+		config.gnuplot_path = argv[2];
+
+	const char* csv_path = argc > 3 ? argv[3] : "vecmap_bench.csv";
+
+	fixture<size_t> int_keys;
+	fixture<std::string> string_keys;
+
+	auto categorys = std::tuple_cat(
+		make_categorys(int_keys, "size_t"),
+		make_categorys(string_keys, "string")
+	);
+	auto suit = make_suit(config, std::move(categorys),
+		std::make_index_sequence<std::tuple_size<decltype(categorys)>::value>());
+
+	suit.perform_categorys(0, max_size);
+
+	std::ofstream csv(csv_path);
+	suit.write_results(csv);
+	suit.render_results();
+
+	std::cout << "results written to " << csv_path << "\n";
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,414 @@
+/*
+* Vool - Coroutines scheduled on a task_queue, needs C++20
+*
+* Copyright (c) 2016 Lukas Bergdoll - www.lukas-bergdoll.net
+*
+* This code is licensed under the Apache License 2.0 (https://opensource.org/licenses/Apache-2.0)
+*/
+
+#ifndef VOOL_TASKCOROUTINE_H_INCLUDED
+#define VOOL_TASKCOROUTINE_H_INCLUDED
+
+#include "TaskQueue.h"
+
+// empty for compilers without coroutine support, so the header can always be included
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define VOOL_TASK_COROUTINES
+#endif
+#endif
+
+#if defined(VOOL_TASK_COROUTINES)
+
+#include <coroutine>
+#include <optional>
+#include <exception>
+#include <utility>
+#include <type_traits>
+
+namespace vool
+{
+
+template<typename T = void> class task;
+
+namespace task_queue_util
+{
+// the queue internals a coroutine needs to suspend on records instead of blocking
+struct coroutine_access
+{
+	// nullptr if the prereq finished and its record was reused, otherwise held until released
+	static async_task* acquire_record(task_queue& queue, const async_t::prereq& prerequisite)
+	{
+		return queue.acquire_record(prerequisite);
+	}
+
+	static void release_record(task_queue& queue, async_task* record)
+	{
+		queue.release_record(record);
+	}
+
+	// a failure that no wait reported yet, also once the record was reused, reporting forgets it
+	static std::exception_ptr report_failure(task_queue& queue, const async_t::prereq& prerequisite)
+	{
+		return queue.find_failure(prerequisite, true).error;
+	}
+
+	// resumes the coroutine on the worker that finished the prereq, even if it failed,
+	// so a suspended coroutine is never lost to a cancelled continuation
+	static void resume_after(task_queue& queue, const async_t::prereq& prerequisite, std::coroutine_handle<> handle)
+	{
+		task_config config;
+		config.inline_continuation = true;
+		queue.emplace_task(
+			queue._records[queue._records.acquire()],
+			[handle]() -> void { handle.resume(); },
+			{ prerequisite },
+			1,
+			config,
+			true
+		);
+	}
+
+	// a task that only becomes ready through open_gate, the opener holds one of the references
+	static async_t::prereq emplace_gate(task_queue& queue, async_task& record, task_function&& task, const uint32_t references)
+	{
+		return queue.emplace_task(record, std::move(task), {}, references, task_config(), true);
+	}
+
+	static void open_gate(task_queue& queue, async_task& record)
+	{
+		if (record.fire())
+			queue.schedule(&record);
+		queue.release_record(&record);
+	}
+
+	static async_task& acquire_record(task_queue& queue)
+	{
+		return queue._records[queue._records.acquire()];
+	}
+
+	template<typename T> static task_future<T> make_future(task_queue& queue, async_task& record, const async_t::prereq& handle)
+	{
+		return task_future<T>(&queue, &record, handle);
+	}
+};
+}
+
+namespace task_coroutine_util
+{
+// suspends the coroutine until the prereq finished, rethrows its exception like task_queue::wait,
+// the record is held from co_await on, a reused one is looked up by the key
+class prereq_awaiter
+{
+public:
+	prereq_awaiter(task_queue& queue, const async_t::prereq& prerequisite)
+		: _queue(queue), _prerequisite(prerequisite), _record(nullptr)
+	{}
+
+	prereq_awaiter(const prereq_awaiter&) = delete;
+	prereq_awaiter& operator=(const prereq_awaiter&) = delete;
+
+	// also if the frame is destroyed while suspended
+	~prereq_awaiter()
+	{
+		if (_record != nullptr)
+			task_queue_util::coroutine_access::release_record(_queue, _record);
+	}
+
+	bool await_ready()
+	{
+		_record = task_queue_util::coroutine_access::acquire_record(_queue, _prerequisite);
+		if (_record != nullptr)
+			return _record->finished();
+
+		_error = task_queue_util::coroutine_access::report_failure(_queue, _prerequisite);
+		return true;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		task_queue_util::coroutine_access::resume_after(_queue, _prerequisite, handle);
+	}
+
+	void await_resume()
+	{
+		if (_record != nullptr && _record->result.has_exception())
+		{
+			_error = _record->result.exception();
+			task_queue_util::coroutine_access::report_failure(_queue, _prerequisite);
+		}
+
+		if (_error)
+			std::rethrow_exception(_error);
+	}
+
+private:
+	task_queue& _queue;
+	async_t::prereq _prerequisite;
+	task_queue_util::async_task* _record; // one reference held while not nullptr
+	std::exception_ptr _error; // of a record that was already reused
+};
+
+template<typename T> class future_awaiter
+{
+public:
+	future_awaiter(task_queue& queue, task_future<T>& future)
+		: _queue(queue), _future(future)
+	{}
+
+	bool await_ready() const { return _future.ready(); }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		task_queue_util::coroutine_access::resume_after(_queue, _future, handle);
+	}
+
+	T await_resume() { return _future.get(); }
+
+private:
+	task_queue& _queue;
+	task_future<T>& _future;
+};
+
+template<typename T> class task_awaiter;
+
+class promise_base
+{
+public:
+	task_queue* queue = nullptr; // set by spawn, inherited by awaited tasks
+	std::coroutine_handle<> continuation; // the awaiting coroutine
+	task_queue_util::async_task* gate = nullptr; // opened once a spawned coroutine finished
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+
+	// hands over to the awaiting coroutine without growing the stack
+	struct final_awaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template<typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+		{
+			auto& promise = handle.promise();
+			if (promise.continuation)
+				return promise.continuation;
+
+			// the gate task destroys the frame, nothing here may touch it afterwards
+			if (promise.gate != nullptr)
+				task_queue_util::coroutine_access::open_gate(*promise.queue, *promise.gate);
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	final_awaiter final_suspend() const noexcept { return {}; }
+
+	void unhandled_exception() noexcept { error = std::current_exception(); }
+
+	prereq_awaiter await_transform(const async_t::prereq& prerequisite)
+	{
+		return prereq_awaiter(attached_queue(), prerequisite);
+	}
+
+	template<typename T> future_awaiter<T> await_transform(task_future<T>& future)
+	{
+		return future_awaiter<T>(attached_queue(), future);
+	}
+
+	// a temporary lives until the awaiting coroutine resumed
+	template<typename T> future_awaiter<T> await_transform(task_future<T>&& future)
+	{
+		return future_awaiter<T>(attached_queue(), future);
+	}
+
+	template<typename T> task_awaiter<T> await_transform(task<T>&& child);
+
+private:
+	task_queue& attached_queue() const
+	{
+		if (queue == nullptr)
+			throw std::logic_error("task was neither spawned nor awaited by a spawned task");
+		return *queue;
+	}
+};
+
+template<typename T> class promise : public promise_base
+{
+public:
+	task<T> get_return_object() noexcept;
+
+	template<typename U> void return_value(U&& value)
+	{
+		_value.emplace(std::forward<U>(value));
+	}
+
+	T take()
+	{
+		if (error)
+			std::rethrow_exception(error);
+		return std::move(*_value);
+	}
+
+private:
+	std::optional<T> _value;
+};
+
+template<> class promise<void> : public promise_base
+{
+public:
+	task<void> get_return_object() noexcept;
+
+	void return_void() const noexcept {}
+
+	void take()
+	{
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+// starts the child coroutine right away and resumes the awaiting one once it returned
+template<typename T> class task_awaiter
+{
+public:
+	explicit task_awaiter(std::coroutine_handle<promise<T>> handle) noexcept : _handle(handle) {}
+
+	bool await_ready() const noexcept { return !_handle || _handle.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		_handle.promise().continuation = awaiting;
+		return _handle;
+	}
+
+	T await_resume() { return _handle.promise().take(); }
+
+private:
+	std::coroutine_handle<promise<T>> _handle;
+};
+}
+
+// a lazily started coroutine, it runs once spawned on a task_queue or awaited by another task,
+// co_await on a prereq, task_future or task suspends it instead of blocking the worker
+template<typename T> class task
+{
+	static_assert(!std::is_reference<T>::value, "task results are stored by value");
+
+public:
+	using promise_type = task_coroutine_util::promise<T>;
+	using handle_t = std::coroutine_handle<promise_type>;
+
+	explicit task(handle_t handle) noexcept : _handle(handle) {}
+
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+
+	task(task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+	task& operator=(task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (_handle)
+				_handle.destroy();
+			_handle = std::exchange(other._handle, nullptr);
+		}
+		return *this;
+	}
+
+	~task()
+	{
+		if (_handle)
+			_handle.destroy();
+	}
+
+	bool valid() const noexcept { return static_cast<bool>(_handle); }
+
+	// the caller owns the frame from now on
+	handle_t release() noexcept { return std::exchange(_handle, nullptr); }
+
+private:
+	friend class task_coroutine_util::promise_base;
+
+	handle_t _handle;
+};
+
+// runs the coroutine on the queue, the returned prereq or task_future finishes once it returned,
+// an exception that left the coroutine fails that task
+template<typename T> std::conditional_t<std::is_void<T>::value, async_t::prereq, task_future<T>>
+	spawn(task_queue& queue, task<T> coroutine);
+
+
+// ----- IMPLEMENTATION -----
+
+template<typename T> task<T> task_coroutine_util::promise<T>::get_return_object() noexcept
+{
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_coroutine_util::promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+template<typename T> task_coroutine_util::task_awaiter<T> task_coroutine_util::promise_base::await_transform(
+	task<T>&& child
+)
+{
+	// the awaited task lives until the awaiting coroutine resumed, so it keeps owning the frame
+	child._handle.promise().queue = queue;
+	return task_awaiter<T>(child._handle);
+}
+
+template<typename T> std::conditional_t<std::is_void<T>::value, async_t::prereq, task_future<T>>
+	spawn(task_queue& queue, task<T> coroutine)
+{
+	using access = task_queue_util::coroutine_access;
+
+	if (!coroutine.valid())
+		throw std::logic_error("spawn of an empty task");
+
+	auto handle = coroutine.release();
+	auto& record = access::acquire_record(queue);
+	handle.promise().queue = &queue;
+	handle.promise().gate = &record;
+
+	// the gate task hands out the result and frees the frame, the opener and a future hold a reference
+	const uint32_t references = std::is_void<T>::value ? 2 : 3;
+	const auto finished = access::emplace_gate(queue, record, [handle, &record]() -> void
+	{
+		if constexpr (std::is_void<T>::value)
+		{
+			auto error = handle.promise().error;
+			handle.destroy();
+			if (error)
+				std::rethrow_exception(error);
+		}
+		else
+		{
+			std::optional<T> value;
+			std::exception_ptr error;
+			try { value.emplace(handle.promise().take()); }
+			catch (...) { error = std::current_exception(); }
+
+			handle.destroy();
+			if (error)
+				std::rethrow_exception(error);
+			record.result.template emplace<T>(std::move(*value));
+		}
+	}, references);
+
+	queue.add_task([handle]() -> void { handle.resume(); });
+
+	if constexpr (std::is_void<T>::value)
+		return finished;
+	else
+		return access::make_future<T>(queue, record, finished);
+}
+
+}
+
+#endif // VOOL_TASK_COROUTINES
+
+#endif // VOOL_TASKCOROUTINE_H_INCLUDED
\ No newline at end of file
@@ -10,6 +10,14 @@
 
 #include <algorithm>
 #include <cassert>
+#include <limits>
+#include <string>
+
+#if defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace vool
 {
@@ -32,176 +40,809 @@ template<typename T> prereq::prereq(const T& init)
 
 }
 
+namespace task_queue_util
+{
+
+// ids as listed by sysfs, e.g. "0-3,8,10-11"
+std::vector<unsigned> parse_id_list(const std::string& list)
+{
+	std::vector<unsigned> ids;
+	size_t position = 0;
+	while (position < list.size())
+	{
+		size_t end = list.find(',', position);
+		if (end == std::string::npos)
+			end = list.size();
+
+		const auto range = list.substr(position, end - position);
+		const auto dash = range.find('-');
+		try
+		{
+			const auto first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+			const auto last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+			for (unsigned id = first; id <= last; ++id)
+				ids.push_back(id);
+		}
+		catch (std::exception&) {} // trailing newline or garbage
+
+		position = end + 1;
+	}
+	return ids;
+}
+
+// the cpus this process may use grouped by numa node, one node with no cpus if unknown
+std::vector<std::vector<unsigned>> cpu_nodes()
+{
+	std::vector<std::vector<unsigned>> nodes;
+
+#if defined(__linux__)
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	const bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	const auto read_line = [](const std::string& path) -> std::string
+	{
+		std::ifstream file(path);
+		std::string line;
+		std::getline(file, line);
+		return line;
+	};
+
+	for (const auto node : parse_id_list(read_line("/sys/devices/system/node/online")))
+	{
+		std::vector<unsigned> cpus;
+		for (const auto cpu : parse_id_list(read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")))
+			if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+				cpus.push_back(cpu);
+
+		// memory only nodes and nodes outside of our cpu set can not host workers
+		if (!cpus.empty())
+			nodes.push_back(std::move(cpus));
+	}
+#endif
+
+	if (nodes.empty())
+		nodes.emplace_back();
+	return nodes;
+}
+
+void pin_thread(std::thread& thread, const unsigned cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set); // best effort
+#else
+	static_cast<void>(thread);
+	static_cast<void>(cpu);
+#endif
+}
+
+// the worker running on this thread, tasks that become ready here go to its deque
+struct worker_context
+{
+	const task_queue* queue;
+	size_t index;
+	size_t looks; // for aging
+	async_task* continuation; // runs right after the current task
+};
+
+thread_local worker_context current_worker = { nullptr, 0, 0, nullptr };
+
+// the innermost critical_path_scope of this thread
+thread_local critical_path_scope* current_scope = nullptr;
+
+}
+
 // --- task_queue ---
 
-inline bool task_queue::task_active(task_queue_util::async_task& task)
+task_queue_util::async_task* task_queue::find_task(const size_t index)
+{
+	// starvation protection, now and then the lower priorities go first
+	auto& worker = task_queue_util::current_worker;
+	if (_aging_interval != 0 && ++worker.looks % _aging_interval == 0)
+	{
+		if (auto task = pop_lane(_low_tasks))
+			return task;
+		if (auto task = find_normal_task(index))
+			return task;
+	}
+
+	if (auto task = _deadline_tasks.pop())
+		return task;
+
+	if (auto task = pop_lane(_high_tasks))
+		return task;
+
+	if (auto task = find_normal_task(index))
+		return task;
+
+	return pop_lane(_low_tasks);
+}
+
+task_queue_util::async_task* task_queue::find_normal_task(const size_t index)
 {
-	if (task.active_flag.test_and_set(std::memory_order_acq_rel))
-		return true;
+	constexpr size_t max_batch = 32;
+
+	if (auto task = _ranked_tasks.pop())
+		return task;
+
+	auto& local = *_local_tasks[index];
+
+	// newest local task first, its data is the most likely to still be in cache
+	if (auto task = local.pop())
+		return task;
+
+	// tasks that want to run on the node of this worker
+	const auto node = _worker_nodes[index];
+	if (auto task = pop_lane(*_node_tasks[node]))
+		return task;
+
+	// take a batch of the injected tasks, the surplus becomes stealable by idle workers
+	if (_injection_sync.try_lock())
+	{
+		std::lock_guard<lock_t> lock(_injection_sync, std::adopt_lock);
+
+		if (auto task = _injected_tasks.pop())
+		{
+			for (size_t i = 1; i < max_batch; ++i)
+			{
+				auto surplus = _injected_tasks.pop();
+				if (surplus == nullptr)
+					break;
+				local.push(static_cast<task_queue_util::async_task*>(surplus));
+			}
+			return static_cast<task_queue_util::async_task*>(task);
+		}
+	}
+
+	// steal the oldest task of another worker, workers on the same node first
+	for (const auto victim : _victims[index])
+		if (auto task = _local_tasks[victim]->steal())
+			return task;
+
+	// rather run a task away from its node than idle
+	for (size_t i = 1; i < _node_tasks.size(); ++i)
+		if (auto task = pop_lane(*_node_tasks[(node + i) % _node_tasks.size()]))
+			return task;
+
+	return nullptr;
+}
+
+task_queue_util::async_task* task_queue::pop_lane(task_queue_util::mpsc_queue& lane)
+{
+	if (lane.empty() || !_injection_sync.try_lock())
+		return nullptr;
+
+	std::lock_guard<lock_t> lock(_injection_sync, std::adopt_lock);
+	return static_cast<task_queue_util::async_task*>(lane.pop());
+}
+
+void task_queue::run_task(task_queue_util::async_task* record)
+{
+	auto& worker = task_queue_util::current_worker;
+	do
+	{
+		if (!record->cancelled())
+		{
+			// an exception stays with the task, the worker carries on
+			try
+			{
+				record->task();
+			}
+			catch (const task_cancelled&)
+			{
+				record->fail(std::current_exception(), true);
+			}
+			catch (...)
+			{
+				record->fail(std::current_exception(), false);
+			}
+		}
+
+		finish_task(record);
+
+		// a continuation made ready by finish_task, in a loop so chains do not recurse
+		record = worker.continuation;
+		worker.continuation = nullptr;
+	} while (record != nullptr);
+}
+
+void task_queue::schedule(task_queue_util::async_task* record)
+{
+	enqueue(record);
+	notify_work();
+}
+
+void task_queue::enqueue(task_queue_util::async_task* record)
+{
+	const auto& worker = task_queue_util::current_worker;
+	if (record->deadline != task_config::clock_t::time_point::max())
+		_deadline_tasks.push(record->deadline, record);
+	else if (record->priority == task_priority::high)
+		_high_tasks.push(record);
+	else if (record->priority == task_priority::low)
+		_low_tasks.push(record);
+	else if (record->rank != 0)
+		_ranked_tasks.push(record->rank, record);
+	else if (record->node < _node_tasks.size()
+		&& (worker.queue != this || _worker_nodes[worker.index] != record->node))
+		_node_tasks[record->node]->push(record);
+	else if (worker.queue == this)
+		_local_tasks[worker.index]->push(record);
 	else
-		task.active_flag.clear(std::memory_order_release);
-	return false;
+		_injected_tasks.push(record);
 }
 
+void task_queue::notify_work(const size_t ready_count)
+{
+	_work_epoch.fetch_add(1, std::memory_order_seq_cst);
 
-bool task_queue::task_ready(
-	const tasks_t::iterator task_it,
-	keys_t& relevant_tasks_keys
-)
+	// parking workers announce themselves before they check the epoch a last time,
+	// so either they see the new epoch or we see them
+	if (_sleeping_workers.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(_park_mutex);
+		if (ready_count > 1)
+			_work_cv.notify_all();
+		else
+			_work_cv.notify_one();
+	}
+
+	// workers waiting inside a task park on _done_cv, new work has to wake them as well
+	if (_helping_workers.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(_park_mutex);
+		_done_cv.notify_all();
+	}
+}
+
+void task_queue::park_worker(const uint64_t epoch)
 {
-	bool ready = true;
+	_sleeping_workers.fetch_add(1, std::memory_order_seq_cst);
+	{
+		std::unique_lock<std::mutex> lock(_park_mutex);
+		while (_work_epoch.load(std::memory_order_seq_cst) == epoch
+			&& _active.load(std::memory_order_acquire))
+			_work_cv.wait(lock);
+	}
+	_sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template<typename Pred> void task_queue::wait_until(Pred done)
+{
+	constexpr size_t spin_count = 64;
 
-	for (const auto& prerequisite : (task_it->second.prerequisites()))
+	// a worker never idles in a wait, it runs ready tasks until its own condition holds
+	const auto& worker = task_queue_util::current_worker;
+	if (worker.queue == this)
 	{
-		auto task_it = _tasks.find(prerequisite.key());
-		assert(task_it != _tasks.end() &&
-			"A task from _tasks was removed although it still was a prerequisite!");
+		help_until(worker.index, done);
+		return;
+	}
 
-		relevant_tasks_keys.push_back(prerequisite.key());
+	// the awaited task is often about to finish, check a few times before parking
+	for (size_t i = 0; i < spin_count; ++i)
+	{
+		if (done())
+			return;
+		task_queue_util::cpu_relax();
+	}
+
+	_waiting_threads.fetch_add(1, std::memory_order_seq_cst);
+	while (true)
+	{
+		const auto epoch = _done_epoch.load(std::memory_order_seq_cst);
+		if (done())
+			break;
 
-		if (task_active(task_it->second))
-			ready = false;
+		std::unique_lock<std::mutex> lock(_park_mutex);
+		while (_done_epoch.load(std::memory_order_seq_cst) == epoch)
+			_done_cv.wait(lock);
 	}
+	_waiting_threads.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template<typename Pred> void task_queue::help_until(const size_t index, Pred done)
+{
+	constexpr size_t spin_count = 16;
+	constexpr size_t relax_count = 16;
+
+	while (!done())
+	{
+		if (auto task = find_task(index))
+		{
+			run_task(task);
+			continue;
+		}
+
+		// announced before the last look, so a finished task or new work either is seen or wakes us
+		_waiting_threads.fetch_add(1, std::memory_order_seq_cst);
+		_helping_workers.fetch_add(1, std::memory_order_seq_cst);
+		const auto work_epoch = _work_epoch.load(std::memory_order_seq_cst);
+		const auto done_epoch = _done_epoch.load(std::memory_order_seq_cst);
+
+		task_queue_util::async_task* task = nullptr;
+		bool finished = done();
+		for (size_t i = 0; i < spin_count && task == nullptr && !finished; ++i)
+		{
+			for (size_t relax = 0; relax < relax_count; ++relax)
+				task_queue_util::cpu_relax();
+			task = find_task(index);
+			finished = task == nullptr && done();
+		}
+
+		if (task == nullptr && !finished)
+		{
+			std::unique_lock<std::mutex> lock(_park_mutex);
+			while (_work_epoch.load(std::memory_order_seq_cst) == work_epoch
+				&& _done_epoch.load(std::memory_order_seq_cst) == done_epoch)
+				_done_cv.wait(lock);
+		}
+
+		_helping_workers.fetch_sub(1, std::memory_order_relaxed);
+		_waiting_threads.fetch_sub(1, std::memory_order_relaxed);
 
-	return ready;
+		if (task != nullptr)
+			run_task(task);
+	}
 }
 
-void task_queue::launch_unstarted(
-	keys_t& relevant_tasks_keys
-)
+bool task_queue::cancels_dependents(const bool cancellation) const
+{
+	// a cancellation reaches the dependents no matter the failure policy
+	return cancellation || _failure_policy == task_failure_policy::cancel_dependents;
+}
+
+void task_queue::finish_task(task_queue_util::async_task* record)
 {
-	keys_t still_unstarted_tasks_keys;
-	for (const auto unstarted_key : _unstarted_tasks_keys)
+	// the exception stays findable by the key once the record is reused,
+	// only the first real failure is kept for wait_all
+	const bool failed = record->result.has_exception();
+	const bool cancellation = failed && record->cancellation();
+	if (failed)
 	{
-		auto task_it = _tasks.find(unstarted_key);
-		assert(task_it != _tasks.end() && "An unstarted task was removed from _tasks");
+		const auto& error = record->result.exception();
+
+		std::lock_guard<std::mutex> lock(_exception_sync);
+		_failures[record->key()] = failure{ error, cancellation };
+		_failure_count.store(_failures.size(), std::memory_order_release);
+		if (!_first_error && !cancellation)
+			_first_error = error;
+	}
 
-		relevant_tasks_keys.push_back(unstarted_key);
+	const bool cancel = failed && cancels_dependents(cancellation);
 
-		if (task_ready(task_it, relevant_tasks_keys))
+	// release the successors, the ones without other unfinished prerequisites are ready now
+	auto& worker = task_queue_util::current_worker;
+	auto edge = record->take_successors();
+	while (edge != nullptr)
+	{
+		auto successor = edge->task;
+		bool ready = false;
+		if (successor->any_prerequisite)
 		{
-			// dispatch task
-			task_it->second.future =
-				std::async(std::launch::async, std::move(task_it->second.task));
+			ready = successor->fire();
 		}
 		else
-			still_unstarted_tasks_keys.push_back(unstarted_key);
+		{
+			if (cancel)
+				successor->cancel(record->result.exception(), cancellation);
+			ready = successor->release_pending();
+		}
+
+		// the first inline continuation runs next on this worker, no hop through a deque
+		if (ready && successor->inline_continuation && worker.queue == this && worker.continuation == nullptr)
+			worker.continuation = successor;
+		else if (ready)
+			schedule(successor);
+
+		if (successor->any_prerequisite)
+			release_record(successor); // the reference of the edge
+
+		auto next = edge->next;
+		_edges.release(edge->index);
+		edge = next;
+	}
+
+	// a persistent record runs its task again on the next restart
+	if (!record->persistent())
+		record->task = nullptr;
+
+	_unfinished_tasks.fetch_sub(1, std::memory_order_seq_cst);
+	_done_epoch.fetch_add(1, std::memory_order_seq_cst);
+	if (_waiting_threads.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(_park_mutex);
+		_done_cv.notify_all();
 	}
 
-	_unstarted_tasks_keys = std::move(still_unstarted_tasks_keys);
+	release_record(record);
 }
 
-void task_queue::remove_finished_tasks(
-	keys_t& keys
-)
+task_queue_util::async_task* task_queue::acquire_record(const async_t::prereq& prerequisite)
 {
-	std::sort(keys.begin(), keys.end());
-	auto last = std::unique(keys.begin(), keys.end());
-	keys.erase(last, keys.end());
-
-	keys_t irrelevant_keys;
-	for (auto& task : _tasks)
-		if (std::binary_search(keys.begin(), keys.end(), task.first) == false)
-			if (task_active(task.second) == false)
-				irrelevant_keys.push_back(task.first);
+	const auto index = static_cast<uint32_t>(prerequisite.key());
+	const auto generation = static_cast<uint32_t>(prerequisite.key() >> 32);
 
+	// generation 0 is never handed out
+	if (generation == 0 || index >= _records.capacity())
+		return nullptr;
 
-	for (const auto key : irrelevant_keys)
-		_tasks.erase(key);
+	auto& record = _records[index];
+	return record.try_acquire(generation) ? &record : nullptr;
 }
 
+void task_queue::check_config(const task_config& config) const
+{
+	if (config.node != task_config::any_node && config.node >= _node_tasks.size())
+		throw std::invalid_argument("task_config node hint beyond the numa nodes of the task_queue");
+}
 
-void task_queue::queue_loop()
+task_queue::failure task_queue::find_failure(const async_t::prereq& prerequisite, const bool forget)
 {
-	constexpr size_t min_reserve = 100;
+	// written before the failed record is released, so a stale key sees the count
+	if (_failure_count.load(std::memory_order_acquire) == 0)
+		return failure{ nullptr, false };
 
-	keys_t relevant_tasks_keys;
+	std::lock_guard<std::mutex> lock(_exception_sync);
+	const auto found = _failures.find(prerequisite.key());
+	if (found == _failures.end())
+		return failure{ nullptr, false };
 
-	relevant_tasks_keys.reserve(min_reserve);
+	const auto known = found->second;
+	if (forget)
+	{
+		_failures.erase(found);
+		_failure_count.store(_failures.size(), std::memory_order_release);
+	}
+	return known;
+}
 
-	while (_active.test_and_set(std::memory_order_acq_rel))
+void task_queue::release_record(task_queue_util::async_task* record)
+{
+	if (record->release())
 	{
-		relevant_tasks_keys.clear();
+		record->result.reset();
+		_records.release(record->index);
+	}
+}
+
+void task_queue::worker_loop(const size_t index)
+{
+	constexpr size_t min_spin = 4;
+	constexpr size_t max_spin = 256;
+	constexpr size_t relax_count = 16;
+
+	task_queue_util::current_worker = { this, index, 0, nullptr };
+
+	// grows while spinning finds work and shrinks while it does not
+	size_t spin_limit = min_spin;
 
-		task_queue_util::atomic_lock lock(_sync);
+	while (_active.load(std::memory_order_acquire))
+	{
+		if (auto task = find_task(index))
+		{
+			run_task(task);
+			continue;
+		}
 
-		launch_unstarted(relevant_tasks_keys);
+		// the epoch is read before the last look for work, anything scheduled later wakes us
+		const auto epoch = _work_epoch.load(std::memory_order_seq_cst);
 
-		remove_finished_tasks(relevant_tasks_keys);
+		task_queue_util::async_task* task = nullptr;
+		for (size_t i = 0; i < spin_limit && task == nullptr; ++i)
+		{
+			for (size_t relax = 0; relax < relax_count; ++relax)
+				task_queue_util::cpu_relax();
+			task = find_task(index);
+		}
 
-		std::this_thread::yield();
+		if (task != nullptr)
+		{
+			spin_limit = std::min(spin_limit * 2, max_spin);
+			run_task(task);
+		}
+		else
+		{
+			spin_limit = std::max(spin_limit / 2, min_spin);
+			park_worker(epoch);
+		}
 	}
 }
 
-void task_queue::remove_finished_prerequisites
-(std::vector<async_t::prereq>& prerequisites)
+async_t::prereq task_queue::emplace_task(
+	task_queue_util::task_function&& task,
+	std::vector<async_t::prereq> prerequisites
+)
 {
-	
-	prerequisites.erase(
-		std::remove_if(prerequisites.begin(), prerequisites.end(),
-			[&tasks = _tasks](const auto prerequisite) -> bool
-			{ return tasks.count(prerequisite.key()) == 0; }
-		),
-		prerequisites.end()
-	);
+	return emplace_task(_records[_records.acquire()], std::move(task), std::move(prerequisites), 1, task_config());
 }
 
 async_t::prereq task_queue::emplace_task(
-	async_t::task_t&& task,
-	std::vector<async_t::prereq> prerequisites
+	task_queue_util::async_task& record,
+	task_queue_util::task_function&& task,
+	std::vector<async_t::prereq> prerequisites,
+	const uint32_t references,
+	const task_config& config,
+	const bool any_prerequisite
 )
 {
-	task_queue_util::atomic_lock lock(_sync);
+	const async_t::prereq handle(record.start(std::move(task), references, config));
+	_unfinished_tasks.fetch_add(1, std::memory_order_relaxed);
 
-	if (prerequisites.size() > 0)
-		remove_finished_prerequisites(prerequisites);
+	link_prerequisites(record, prerequisites, any_prerequisite);
 
-	_tasks.emplace(std::piecewise_construct,
-		std::make_tuple(_start_key),
-		std::forward_as_tuple(
-			std::forward<async_t::task_t>(task),
-			prerequisites
-		)
-	);
-	_unstarted_tasks_keys.push_back(_start_key);
+	// an open scope keeps the hold until it ranked the task
+	auto scope = task_queue_util::current_scope;
+	if (scope != nullptr && &scope->_queue == this)
+	{
+		scope->_tasks.emplace_back(&record, config.cost);
+		return handle;
+	}
 
-	async_t::prereq prerequisite(_start_key);
-	++_start_key;
+	// drop the hold, the task is ready right away if no prerequisite is left
+	if (record.release_pending())
+		schedule(&record);
 
-	return prerequisite;
+	return handle;
 }
 
-void task_queue::finish_all_active_tasks()
+void task_queue::link_prerequisites(
+	task_queue_util::async_task& record,
+	const std::vector<async_t::prereq>& prerequisites,
+	const bool any_prerequisite
+)
 {
-	while (true)
+	// one more pending count that the first finished prerequisite fires
+	record.any_prerequisite = any_prerequisite;
+	if (any_prerequisite)
+		record.pending.fetch_add(1, std::memory_order_relaxed);
+
+	// link to every prerequisite that did not finish yet
+	for (const auto& prerequisite : prerequisites)
 	{
-		// wait until all tasks are finished
-		task_queue_util::atomic_lock lock(_sync);
+		auto predecessor = acquire_record(prerequisite);
+		if (predecessor == nullptr)
+		{
+			if (any_prerequisite)
+			{
+				record.fire();
+				continue;
+			}
 
-		if (_tasks.size() == 0)
-			break;
-		std::this_thread::yield();
+			// reused, but a failure that was not reported yet is still known by the key
+			const auto known = find_failure(prerequisite, false);
+			if (known.error && cancels_dependents(known.cancellation))
+				record.cancel(known.error, known.cancellation);
+			continue;
+		}
+
+		if (any_prerequisite)
+		{
+			// the edge keeps the record alive, it may be reached after the task finished
+			record.add_reference();
+
+			auto& edge = _edges[_edges.acquire()];
+			edge.task = &record;
+			if (!predecessor->add_successor(&edge))
+			{
+				_edges.release(edge.index);
+				record.release(); // never the last reference, the caller holds one
+				record.fire();
+			}
+
+			release_record(predecessor);
+			continue;
+		}
+
+		record.pending.fetch_add(1, std::memory_order_relaxed);
+
+		auto& edge = _edges[_edges.acquire()];
+		edge.task = &record;
+		if (!predecessor->add_successor(&edge))
+		{
+			record.pending.fetch_sub(1, std::memory_order_relaxed);
+			_edges.release(edge.index);
+
+			// finished, but the record was not reused yet so its exception is still known
+			if (predecessor->result.has_exception() && cancels_dependents(predecessor->cancellation()))
+				record.cancel(predecessor->result.exception(), predecessor->cancellation());
+		}
+
+		release_record(predecessor);
 	}
 }
 
+void task_queue::link_held(task_queue_util::async_task& predecessor, task_queue_util::async_task& successor)
+{
+	successor.pending.fetch_add(1, std::memory_order_relaxed);
 
-task_queue::task_queue() noexcept :
-	_start_key(std::numeric_limits<async_t::key_t>::min())
+	auto& edge = _edges[_edges.acquire()];
+	edge.task = &successor;
+	const bool linked = predecessor.add_successor(&edge);
+	assert(linked);
+	static_cast<void>(linked);
+}
+
+task_batch task_queue::emplace_batch(
+	std::vector<task_queue_util::task_function>&& tasks,
+	std::vector<async_t::prereq> prerequisites,
+	const task_config& config
+)
 {
-	_active.test_and_set(std::memory_order_acq_rel); // true state represents active state
-	_sync.clear(std::memory_order_release); // true state represents active state
+	task_config inline_config = config;
+	inline_config.inline_continuation = true;
+
+	// the group record finishes after every task of the batch
+	auto& group = _records[_records.acquire()];
+	task_batch batch(async_t::prereq(group.start([]() -> void {}, 1, inline_config)));
+	batch.tasks.reserve(tasks.size());
+	_unfinished_tasks.fetch_add(tasks.size() + 1, std::memory_order_relaxed);
+
+	// the shared prerequisites are linked once to a gate in front of the batch,
+	// which costs prerequisites + tasks edges instead of prerequisites * tasks
+	task_queue_util::async_task* gate = nullptr;
+	if (!prerequisites.empty())
+	{
+		gate = &_records[_records.acquire()];
+		gate->start([]() -> void {}, 1, inline_config);
+		_unfinished_tasks.fetch_add(1, std::memory_order_relaxed);
+		link_prerequisites(*gate, prerequisites, false);
 
-											// start the workthread
-	std::function<void()> queue([this]() -> void { queue_loop(); });
-	_queue_loop_future = std::async(std::launch::async, std::move(queue));
+		// only the hold is left and no cancel flag is set, the tasks need no edge to the gate
+		if (gate->pending.load(std::memory_order_acquire) == 1)
+		{
+			gate->release_pending();
+			schedule(gate);
+			gate = nullptr;
+		}
+	}
+
+	// every record keeps its hold until the whole batch is linked
+	std::vector<task_queue_util::async_task*> records;
+	records.reserve(tasks.size());
+	for (auto& task : tasks)
+	{
+		auto& record = _records[_records.acquire()];
+		batch.tasks.emplace_back(record.start(std::move(task), 1, config));
+
+		if (gate != nullptr)
+			link_held(*gate, record);
+		link_held(record, group);
+
+		records.push_back(&record);
+	}
+
+	auto scope = task_queue_util::current_scope;
+	if (scope != nullptr && &scope->_queue == this)
+	{
+		// in topological order, the gate cost nothing of its own
+		if (gate != nullptr)
+			scope->_tasks.emplace_back(gate, 0);
+		for (auto record : records)
+			scope->_tasks.emplace_back(record, config.cost);
+		scope->_tasks.emplace_back(&group, 0);
+		return batch;
+	}
+
+	// publish the ready tasks together and wake the workers once
+	size_t ready_count = 0;
+	for (auto record : records)
+	{
+		if (record->release_pending())
+		{
+			enqueue(record);
+			++ready_count;
+		}
+	}
+	if (ready_count > 0)
+		notify_work(ready_count);
+
+	if (gate != nullptr && gate->release_pending())
+		schedule(gate);
+
+	if (group.release_pending())
+		schedule(&group);
+
+	return batch;
+}
+
+void task_queue::finish_all_active_tasks()
+{
+	// wait until all tasks are finished
+	wait_until([this]() -> bool
+	{
+		return _unfinished_tasks.load(std::memory_order_seq_cst) == 0;
+	});
+}
+
+
+task_queue::task_queue() :
+	task_queue(task_queue_config())
+{ }
+
+task_queue::task_queue(const task_queue_config& config) :
+	_active(true),
+	_failure_policy(config.failure_policy),
+	_aging_interval(config.aging_interval),
+	_unfinished_tasks(0),
+	_work_epoch(0),
+	_done_epoch(0),
+	_sleeping_workers(0),
+	_waiting_threads(0),
+	_helping_workers(0),
+	_failure_count(0)
+{
+	// a fixed set of workers runs all tasks, no thread is created per task
+	const size_t worker_count = std::max<size_t>(config.worker_count, 1);
+
+	_local_tasks.reserve(worker_count);
+	for (size_t i = 0; i < worker_count; ++i)
+		_local_tasks.emplace_back(new task_queue_util::work_stealing_deque<task_queue_util::async_task>());
+
+	// worker i goes to node i % nodes, so every node gets its share of the workers,
+	// the records keep a node in a byte, any_node included
+	const auto nodes = task_queue_util::cpu_nodes();
+	const size_t node_count = std::min({ nodes.size(), worker_count, static_cast<size_t>(task_config::any_node) });
+	for (size_t node = 0; node < node_count; ++node)
+		_node_tasks.emplace_back(new task_queue_util::mpsc_queue());
+
+	_worker_nodes.reserve(worker_count);
+	for (size_t i = 0; i < worker_count; ++i)
+		_worker_nodes.push_back(i % node_count);
+
+	_victims.resize(worker_count);
+	for (size_t i = 0; i < worker_count; ++i)
+	{
+		for (size_t k = 1; k < worker_count; ++k)
+			if (_worker_nodes[(i + k) % worker_count] == _worker_nodes[i])
+				_victims[i].push_back((i + k) % worker_count);
+		for (size_t k = 1; k < worker_count; ++k)
+			if (_worker_nodes[(i + k) % worker_count] != _worker_nodes[i])
+				_victims[i].push_back((i + k) % worker_count);
+	}
+
+	_workers.reserve(worker_count);
+	for (size_t i = 0; i < worker_count; ++i)
+	{
+		_workers.emplace_back([this, i]() -> void { worker_loop(i); });
+
+		const auto& cpus = nodes[_worker_nodes[i]];
+		if (config.pin_workers && !cpus.empty())
+			task_queue_util::pin_thread(_workers.back(), cpus[(i / node_count) % cpus.size()]);
+	}
 }
 
 task_queue::~task_queue() noexcept
 {
 	finish_all_active_tasks();
-	_active.clear(std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(_park_mutex);
+		_active.store(false, std::memory_order_release);
+	}
+	_work_cv.notify_all();
+
+	for (auto& worker : _workers)
+		worker.join();
+}
 
-	_queue_loop_future.wait();
+async_t::prereq task_queue::when_all(std::vector<async_t::prereq> prerequisites)
+{
+	task_config config;
+	config.inline_continuation = true;
+	return emplace_task(_records[_records.acquire()], []() -> void {}, std::move(prerequisites), 1, config);
+}
+
+async_t::prereq task_queue::when_any(std::vector<async_t::prereq> prerequisites)
+{
+	if (prerequisites.empty())
+		return async_t::prereq(async_t::key_t(0)); // never valid, so always finished
+
+	task_config config;
+	config.inline_continuation = true;
+	return emplace_task(_records[_records.acquire()], []() -> void {}, std::move(prerequisites), 1, config, true);
 }
 
 async_t::prereq task_queue::add_task(
@@ -236,19 +877,245 @@ async_t::prereq task_queue::add_task(
 
 void task_queue::wait(const async_t::prereq& prerequisite)
 {
-	while (true)
+	auto record = acquire_record(prerequisite);
+	if (record == nullptr)
 	{
-		task_queue_util::atomic_lock lock(_sync);
+		// finished and maybe already reused, a failure is reported once
+		const auto known = find_failure(prerequisite, true);
+		if (known.error)
+			std::rethrow_exception(known.error);
+		return;
+	}
+
+	wait_until([record]() -> bool { return record->finished(); });
 
-		if (_tasks.find(prerequisite.key()) == _tasks.end())
-			break; // task is finished and was deleted
-		std::this_thread::yield();
+	std::exception_ptr error;
+	if (record->result.has_exception())
+		error = record->result.exception();
+	release_record(record);
+
+	if (error)
+	{
+		find_failure(prerequisite, true);
+		std::rethrow_exception(error);
 	}
 }
 
 void task_queue::wait_all()
 {
+	if (task_queue_util::current_worker.queue == this)
+		throw std::logic_error("wait_all inside a task of the same task_queue");
+
 	finish_all_active_tasks();
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(_exception_sync);
+		error.swap(_first_error);
+		_failures.clear();
+		_failure_count.store(0, std::memory_order_release);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// --- critical_path_scope ---
+
+critical_path_scope::critical_path_scope(task_queue& queue)
+	: _queue(queue), _outer(task_queue_util::current_scope)
+{
+	task_queue_util::current_scope = this;
+}
+
+critical_path_scope::~critical_path_scope()
+{
+	task_queue_util::current_scope = _outer;
+
+	// submission order is a topological order, so walking it backwards
+	// ranks every successor inside the scope before its prerequisites
+	for (auto it = _tasks.rbegin(); it != _tasks.rend(); ++it)
+	{
+		uint64_t longest = 0;
+		for (auto edge = it->first->peek_successors(); edge != nullptr; edge = edge->next)
+			longest = std::max<uint64_t>(longest, edge->task->rank);
+
+		it->first->rank = static_cast<uint32_t>(std::min<uint64_t>(
+			longest + std::max<uint32_t>(it->second, 1), std::numeric_limits<uint32_t>::max()));
+	}
+
+	for (auto& task : _tasks)
+		if (task.first->release_pending())
+			_queue.schedule(task.first);
+}
+
+// --- task_graph ---
+
+task_graph::task_graph() noexcept
+	:
+	_compiled(true),
+	_valid(true),
+	_tasks(nullptr),
+	_task_count(0),
+	_queue(nullptr),
+	_remaining(0),
+	_failed(false)
+{ }
+
+task_graph::~task_graph()
+{
+	destroy_tasks();
+}
+
+void task_graph::add_edge(const node_t before, const node_t after)
+{
+	if (before >= _nodes.size() || after >= _nodes.size())
+		throw std::out_of_range("task_graph edge to an unknown node");
+
+	_edges.emplace_back(before, after);
+	_compiled = false;
+}
+
+bool task_graph::validate()
+{
+	if (_compiled)
+		return _valid;
+
+	const size_t count = _nodes.size();
+
+	// successors as one flat array, grouped by their prerequisite
+	_offsets.assign(count + 1, 0);
+	_prerequisite_counts.assign(count, 0);
+	for (const auto& edge : _edges)
+	{
+		++_offsets[edge.first + 1];
+		++_prerequisite_counts[edge.second];
+	}
+	for (size_t i = 0; i < count; ++i)
+		_offsets[i + 1] += _offsets[i];
+
+	_successors.resize(_edges.size());
+	std::vector<size_t> fill(_offsets.begin(), _offsets.end() - 1);
+	for (const auto& edge : _edges)
+		_successors[fill[edge.first]++] = edge.second;
+
+	_roots.clear();
+	for (node_t node = 0; node < count; ++node)
+		if (_prerequisite_counts[node] == 0)
+			_roots.push_back(node);
+
+	// Kahn's algorithm, a node that is never reached is part of a cycle
+	std::vector<uint32_t> pending(_prerequisite_counts);
+	std::vector<node_t> ready(_roots);
+	size_t reached = 0;
+	while (!ready.empty())
+	{
+		const node_t node = ready.back();
+		ready.pop_back();
+		++reached;
+
+		for (size_t i = _offsets[node]; i < _offsets[node + 1]; ++i)
+			if (--pending[_successors[i]] == 0)
+				ready.push_back(_successors[i]);
+	}
+
+	build_tasks();
+	_valid = reached == count;
+	_compiled = true;
+	return _valid;
+}
+
+void task_graph::build_tasks()
+{
+	using task_queue_util::async_task;
+
+	destroy_tasks();
+	if (_nodes.empty())
+		return;
+
+	const size_t bytes = sizeof(async_task) * _nodes.size();
+	_task_storage.reset(new char[bytes + alignof(async_task)]);
+	void* aligned = _task_storage.get();
+	size_t space = bytes + alignof(async_task);
+	_tasks = static_cast<async_task*>(std::align(alignof(async_task), bytes, aligned, space));
+
+	for (node_t node = 0; node < _nodes.size(); ++node)
+	{
+		new (_tasks + node) async_task(static_cast<uint32_t>(node));
+		_tasks[node].task = task_queue_util::task_function([this, node]() -> void { execute(node); });
+		++_task_count;
+	}
+}
+
+void task_graph::destroy_tasks() noexcept
+{
+	for (size_t i = 0; i < _task_count; ++i)
+		_tasks[i].~async_task();
+
+	_task_storage.reset();
+	_tasks = nullptr;
+	_task_count = 0;
+}
+
+void task_graph::run(task_queue& queue)
+{
+	if (!validate())
+		throw std::logic_error("task_graph contains a cycle");
+
+	if (_nodes.empty())
+		return;
+
+	for (node_t node = 0; node < _task_count; ++node)
+		_tasks[node].restart(_prerequisite_counts[node]);
+
+	_queue = &queue;
+	_failed.store(false, std::memory_order_relaxed);
+	_error = nullptr;
+	_remaining.store(_task_count, std::memory_order_release);
+
+	// the roots go straight to the workers, woken once
+	queue._unfinished_tasks.fetch_add(_task_count, std::memory_order_relaxed);
+	for (const auto root : _roots)
+		queue.enqueue(_tasks + root);
+	queue.notify_work(_roots.size());
+
+	queue.wait_until([this]() -> bool { return _remaining.load(std::memory_order_acquire) == 0; });
+
+	// the worker of the last nodes may still be finishing their records
+	for (node_t node = 0; node < _task_count; ++node)
+		while (_tasks[node].references() > 1)
+			task_queue_util::cpu_relax();
+
+	if (_error)
+		std::rethrow_exception(_error);
+}
+
+void task_graph::execute(const node_t node)
+{
+	if (!_failed.load(std::memory_order_relaxed))
+	{
+		try
+		{
+			_nodes[node]();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(_error_sync);
+			if (!_error)
+				_error = std::current_exception();
+			_failed.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	for (size_t i = _offsets[node]; i < _offsets[node + 1]; ++i)
+	{
+		auto successor = _tasks + _successors[i];
+		if (successor->release_pending())
+			_queue->schedule(successor);
+	}
+
+	// the run may return right after this, so the graph is not touched anymore
+	_remaining.fetch_sub(1, std::memory_order_acq_rel);
 }
 
 namespace task_queue_util
@@ -256,25 +1123,175 @@ namespace task_queue_util
 
 // --- async_task ---
 
-async_task::async_task(
-	async_t::task_t&& user_task,
-	std::vector<async_t::prereq> prereqs
-)
+async_task::async_task(const uint32_t slab_index) noexcept
 	:
-	task(init_task(std::forward<async_t::task_t>(user_task))),
-	_prerequisites(prereqs)
+	index(slab_index),
+	pending(0),
+	priority(task_priority::normal),
+	inline_continuation(false),
+	any_prerequisite(false),
+	node(static_cast<uint8_t>(task_config::any_node)),
+	rank(0),
+	_successors(closed()),
+	_generation_refs(uint64_t(1) << 32)
+{ }
+
+async_t::key_t async_task::start(task_function&& user_task, const uint32_t references, const task_config& config)
 {
-	active_flag.test_and_set(std::memory_order_acq_rel); // default to active
+	task = std::move(user_task);
+	deadline = config.deadline;
+	priority = config.priority;
+	inline_continuation = config.inline_continuation;
+	any_prerequisite = false;
+	node = static_cast<uint8_t>(config.node < task_config::any_node ? config.node : task_config::any_node);
+	rank = 0;
+	pending.store(1, std::memory_order_relaxed);
+	_successors.store(nullptr, std::memory_order_relaxed);
+
+	// the record is free, so nobody else can touch the reference count
+	const uint64_t generation = _generation_refs.load(std::memory_order_relaxed) >> 32;
+	_generation_refs.store((generation << 32) | references, std::memory_order_release);
+
+	return (generation << 32) | index;
 }
 
-inline async_t::task_t async_task::init_task(async_t::task_t&& user_task) noexcept
+void async_task::restart(const uint32_t prerequisites) noexcept
 {
-	async_t::task_t res([u_task = std::move(user_task), &flag_ref = active_flag]() -> void
+	deadline = task_config::clock_t::time_point::max();
+	priority = task_priority::normal;
+	inline_continuation = false;
+	any_prerequisite = false;
+	node = static_cast<uint8_t>(task_config::any_node);
+	rank = 0;
+	pending.store(prerequisites | persistent_flag, std::memory_order_relaxed);
+	_successors.store(nullptr, std::memory_order_relaxed);
+
+	// the running task and the owner
+	const uint64_t generation = _generation_refs.load(std::memory_order_relaxed) >> 32;
+	_generation_refs.store((generation << 32) | 2, std::memory_order_release);
+}
+
+bool async_task::try_acquire(const uint32_t generation) noexcept
+{
+	auto value = _generation_refs.load(std::memory_order_acquire);
+	do
 	{
-		u_task();
-		flag_ref.clear(std::memory_order_release);
-	});
-	return res;
+		// a record without references is free or about to be reused
+		if ((value >> 32) != generation || static_cast<uint32_t>(value) == 0)
+			return false;
+	} while (!_generation_refs.compare_exchange_weak(value, value + 1,
+		std::memory_order_acq_rel, std::memory_order_acquire));
+
+	return true;
+}
+
+bool async_task::release() noexcept
+{
+	const auto value = _generation_refs.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	if (static_cast<uint32_t>(value) != 0)
+		return false;
+
+	// stale handles stop matching, generation 0 is skipped as it marks invalid keys
+	uint32_t generation = static_cast<uint32_t>(value >> 32) + 1;
+	if (generation == 0)
+		generation = 1;
+	_generation_refs.store(uint64_t(generation) << 32, std::memory_order_release);
+
+	return true;
+}
+
+async_t::key_t async_task::key() const noexcept
+{
+	return (_generation_refs.load(std::memory_order_relaxed) >> 32 << 32) | index;
+}
+
+bool async_task::finished() const noexcept
+{
+	return _successors.load(std::memory_order_acquire) == closed();
+}
+
+bool async_task::add_successor(task_edge* edge) noexcept
+{
+	auto head = _successors.load(std::memory_order_acquire);
+	do
+	{
+		if (head == closed())
+			return false;
+		edge->next = head;
+	} while (!_successors.compare_exchange_weak(head, edge,
+		std::memory_order_release, std::memory_order_acquire));
+
+	return true;
+}
+
+task_edge* async_task::take_successors() noexcept
+{
+	return _successors.exchange(closed(), std::memory_order_acq_rel);
+}
+
+bool async_task::release_pending() noexcept
+{
+	const uint32_t flags = cancelled_flag | fired_flag | cancellation_flag | persistent_flag;
+	return (pending.fetch_sub(1, std::memory_order_acq_rel) & ~flags) == 1;
+}
+
+bool async_task::fire() noexcept
+{
+	// only the first finished prerequisite counts
+	if ((pending.fetch_or(fired_flag, std::memory_order_acq_rel) & fired_flag) != 0)
+		return false;
+	return release_pending();
+}
+
+void async_task::add_reference() noexcept
+{
+	_generation_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void async_task::cancel(const std::exception_ptr& error, const bool cancellation) noexcept
+{
+	// the caller still counts as pending, so the task can not start while the exception is stored
+	if ((pending.fetch_or(cancelled_flag, std::memory_order_relaxed) & cancelled_flag) == 0)
+		fail(error, cancellation);
+}
+
+void async_task::fail(std::exception_ptr error, const bool cancellation) noexcept
+{
+	result.set_exception(std::move(error));
+	if (cancellation)
+		pending.fetch_or(cancellation_flag, std::memory_order_relaxed);
+}
+
+bool async_task::cancellation() const noexcept
+{
+	return (pending.load(std::memory_order_relaxed) & cancellation_flag) != 0;
+}
+
+bool async_task::persistent() const noexcept
+{
+	return (pending.load(std::memory_order_relaxed) & persistent_flag) != 0;
+}
+
+uint32_t async_task::references() const noexcept
+{
+	return static_cast<uint32_t>(_generation_refs.load(std::memory_order_acquire));
+}
+
+bool async_task::cancelled() const noexcept
+{
+	return (pending.load(std::memory_order_relaxed) & cancelled_flag) != 0;
+}
+
+const task_edge* async_task::peek_successors() const noexcept
+{
+	return _successors.load(std::memory_order_acquire);
+}
+
+task_edge* async_task::closed() noexcept
+{
+	// marker that is never a real successor
+	static task_edge marker(0);
+	return &marker;
 }
 
 }
@@ -10,8 +10,25 @@
 #define VOOL_TASKQUEUE_H_INCLUDED
 
 #include <vector>
-#include <unordered_map>
 #include <future>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <type_traits>
+#include <cstddef>
+#include <exception>
+#include <chrono>
+#include <iterator>
+#include <unordered_map>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#endif
 
 namespace vool
 {
@@ -38,129 +55,1826 @@ namespace async_t
 namespace task_queue_util
 {
 class async_task;
+
+struct task_edge;
+
+template<typename T> class work_stealing_deque;
+
+template<typename Body> class parallel_range;
+
+struct coroutine_access; // TaskCoroutine.h
+
+// hint to the cpu that this is a spin wait loop
+inline void cpu_relax() noexcept
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+	__builtin_ia32_pause();
+#endif
 }
 
-class task_queue
+// the templated add_task overloads only take void() callables
+template<typename F> using enable_if_task_t = std::enable_if_t<
+	!std::is_same<std::decay_t<F>, async_t::task_t>::value
+	&& std::is_void<decltype(std::declval<std::decay_t<F>&>()())>::value
+>;
+
+// callables returning a value are added as a task_future of the decayed result type
+template<typename F> using task_result_t = std::decay_t<decltype(std::declval<std::decay_t<F>&>()())>;
+
+// the overloads taking a task_config have no std::function counterpart
+template<typename F> using enable_if_void_task_t = std::enable_if_t<std::is_void<task_result_t<F>>::value>;
+
+template<typename F> using enable_if_result_task_t = std::enable_if_t<
+	!std::is_void<task_result_t<F>>::value,
+	task_result_t<F>
+>;
+
+// an element of the range, moved out of it if the range is an rvalue
+template<typename Range, typename T>
+std::conditional_t<std::is_lvalue_reference<Range>::value, T&, T&&> forward_element(T& element) noexcept
+{
+	return static_cast<std::conditional_t<std::is_lvalue_reference<Range>::value, T&, T&&>>(element);
+}
+
+// --- lock policies ---
+
+// backoff policies, wait() is called after every failed lock attempt
+
+// the behaviour of a plain test and set lock, only lets other threads run
+class yield_backoff
 {
 public:
-	using tasks_t = std::unordered_map<async_t::key_t, task_queue_util::async_task>;
-	using keys_t = std::vector<async_t::key_t>;
+	void wait() noexcept { std::this_thread::yield(); }
+};
 
-	explicit task_queue() noexcept;
+// pause for 1, 2, 4 ... cycles, once that gets too long the lock holder
+// is most likely not running, so the time slice is given up instead
+class exponential_backoff
+{
+public:
+	explicit exponential_backoff() noexcept : _pauses(1) {}
 
-	task_queue(const task_queue&) = delete;
-	task_queue(task_queue&&) = delete;
+	void wait() noexcept
+	{
+		if (_pauses > max_pauses)
+		{
+			std::this_thread::yield();
+			return;
+		}
 
-	task_queue& operator=(const task_queue&) = delete;
-	task_queue& operator=(task_queue&&) = delete;
+		for (uint32_t i = 0; i < _pauses; ++i)
+			cpu_relax();
+		_pauses *= 2;
+	}
 
-	~task_queue() noexcept;
+private:
+	static constexpr uint32_t max_pauses = 64;
 
-	async_t::prereq add_task(
-		const async_t::task_t&
-	);
+	uint32_t _pauses;
+};
 
-	async_t::prereq add_task(
-		const async_t::task_t&,
-		std::vector<async_t::prereq>
-	);
+// test and test and set lock, waiting threads only read the lock until it looks free
+template<typename Backoff> class spin_lock
+{
+public:
+	explicit spin_lock() noexcept : _locked(false) {}
 
-	async_t::prereq add_task(
-		async_t::task_t&&
-	);
+	spin_lock(const spin_lock&) = delete;
+	spin_lock(spin_lock&&) = delete;
 
-	async_t::prereq add_task(
-		async_t::task_t&&,
-		std::vector<async_t::prereq>
-	);
+	spin_lock& operator=(const spin_lock&) = delete;
+	spin_lock& operator=(spin_lock&&) = delete;
 
-	void wait(const async_t::prereq&);
+	void lock() noexcept
+	{
+		Backoff backoff;
+		while (_locked.exchange(true, std::memory_order_acquire))
+		{
+			do
+				backoff.wait();
+			while (_locked.load(std::memory_order_relaxed));
+		}
+	}
 
-	void wait_all();
+	bool try_lock() noexcept
+	{
+		return !_locked.load(std::memory_order_relaxed)
+			&& !_locked.exchange(true, std::memory_order_acquire);
+	}
+
+	void unlock() noexcept { _locked.store(false, std::memory_order_release); }
 
 private:
-	std::atomic_flag _sync; // lock synchronisation primitive
-	std::atomic_flag _active; // queue loop lock synchronisation primitive
+	std::atomic<bool> _locked;
+};
 
-	async_t::key_t _start_key;
-	keys_t _unstarted_tasks_keys;
-	tasks_t _tasks;
+// fair fifo lock, every thread spins on the same counter
+// but backs off in proportion to its distance to the front of the line
+class ticket_lock
+{
+public:
+	explicit ticket_lock() noexcept : _next(0), _serving(0) {}
 
-	std::future<void> _queue_loop_future;
+	ticket_lock(const ticket_lock&) = delete;
+	ticket_lock(ticket_lock&&) = delete;
 
-	bool task_active(task_queue_util::async_task&);
+	ticket_lock& operator=(const ticket_lock&) = delete;
+	ticket_lock& operator=(ticket_lock&&) = delete;
 
-	bool task_ready(const tasks_t::iterator, keys_t&);
+	void lock() noexcept
+	{
+		constexpr uint32_t pauses_per_waiter = 16;
+		constexpr uint32_t max_waiters = 4; // further back the holder may not even run
+		constexpr uint32_t max_rounds = 64;
 
-	void launch_unstarted(keys_t&);
+		const uint32_t ticket = _next.fetch_add(1, std::memory_order_relaxed);
+		for (uint32_t round = 0; ; ++round)
+		{
+			const uint32_t distance = ticket - _serving.load(std::memory_order_acquire);
+			if (distance == 0)
+				return;
 
-	void remove_finished_tasks(keys_t&);
+			// a descheduled holder or predecessor has to run before the line moves on
+			if (distance > max_waiters || round > max_rounds)
+				std::this_thread::yield();
+			else
+				for (uint32_t i = 0; i < distance * pauses_per_waiter; ++i)
+					cpu_relax();
+		}
+	}
 
-	void queue_loop();
+	bool try_lock() noexcept
+	{
+		uint32_t serving = _serving.load(std::memory_order_relaxed);
+		return _next.compare_exchange_strong(serving, serving + 1, std::memory_order_acquire);
+	}
 
-	void remove_finished_prerequisites(std::vector<async_t::prereq>&);
+	void unlock() noexcept
+	{
+		_serving.store(_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
 
-	void finish_all_active_tasks();
+private:
+	std::atomic<uint32_t> _next;
+	std::atomic<uint32_t> _serving;
+};
 
-	async_t::prereq emplace_task(
-		async_t::task_t&&,
-		std::vector<async_t::prereq>
-	);
+// used by task_queue, the contention benchmark in bench/taskqueue compares the policies
+using default_lock = spin_lock<exponential_backoff>;
+
+// --- submission queue ---
+
+struct mpsc_hook
+{
+	std::atomic<mpsc_hook*> next_hook;
 };
 
-namespace task_queue_util
+// intrusive multi producer single consumer queue after Dmitry Vyukov,
+// push is wait-free, popped nodes are no longer referenced by the queue
+class mpsc_queue
+{
+public:
+	explicit mpsc_queue() noexcept : _head(&_stub), _tail(&_stub)
+	{
+		_stub.next_hook.store(nullptr, std::memory_order_relaxed);
+	}
+
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue(mpsc_queue&&) = delete;
+
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(mpsc_queue&&) = delete;
+
+	void push(mpsc_hook* node) noexcept
+	{
+		node->next_hook.store(nullptr, std::memory_order_relaxed);
+		auto prev = _head.exchange(node, std::memory_order_acq_rel);
+		prev->next_hook.store(node, std::memory_order_release); // now visible to the consumer
+	}
+
+	// consumer only, nullptr if empty or if a producer is still in the middle of its push
+	mpsc_hook* pop() noexcept
+	{
+		auto tail = _tail.load(std::memory_order_relaxed);
+		auto next = tail->next_hook.load(std::memory_order_acquire);
+
+		if (tail == &_stub)
+		{
+			if (next == nullptr)
+				return nullptr;
+			_tail.store(next, std::memory_order_relaxed);
+			tail = next;
+			next = next->next_hook.load(std::memory_order_acquire);
+		}
+
+		if (next != nullptr)
+		{
+			_tail.store(next, std::memory_order_relaxed);
+			return tail;
+		}
+
+		if (tail != _head.load(std::memory_order_acquire))
+			return nullptr;
+
+		// tail is the last node, the stub takes its place so it can be handed out
+		push(&_stub);
+		next = tail->next_hook.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			_tail.store(next, std::memory_order_relaxed);
+			return tail;
+		}
+		return nullptr;
+	}
+
+	// any thread, a snapshot, a push in progress may not be seen yet
+	bool empty() const noexcept
+	{
+		// the tail is the stub or a node that was not popped yet
+		return _tail.load(std::memory_order_acquire) == &_stub
+			&& _stub.next_hook.load(std::memory_order_acquire) == nullptr;
+	}
+
+private:
+	std::atomic<mpsc_hook*> _head; // producers
+	std::atomic<mpsc_hook*> _tail; // consumer
+	mpsc_hook _stub;
+};
+
+// ready tasks ordered by a key, Compare puts the first task to run on top
+template<typename Key, typename Compare> class ready_heap
+{
+public:
+	explicit ready_heap() noexcept : _size(0) {}
+
+	ready_heap(const ready_heap&) = delete;
+	ready_heap(ready_heap&&) = delete;
+
+	ready_heap& operator=(const ready_heap&) = delete;
+	ready_heap& operator=(ready_heap&&) = delete;
+
+	void push(const Key& key, async_task* task)
+	{
+		std::lock_guard<default_lock> lock(_sync);
+		_heap.emplace_back(key, task);
+		std::push_heap(_heap.begin(), _heap.end(), entry_compare());
+		_size.fetch_add(1, std::memory_order_release);
+	}
+
+	// nullptr if empty, does not lock then
+	async_task* pop()
+	{
+		if (_size.load(std::memory_order_acquire) == 0)
+			return nullptr;
+
+		std::lock_guard<default_lock> lock(_sync);
+		if (_heap.empty())
+			return nullptr;
+
+		std::pop_heap(_heap.begin(), _heap.end(), entry_compare());
+		auto task = _heap.back().second;
+		_heap.pop_back();
+		_size.fetch_sub(1, std::memory_order_relaxed);
+		return task;
+	}
+
+private:
+	using entry_t = std::pair<Key, async_task*>;
+
+	struct entry_compare
+	{
+		bool operator()(const entry_t& a, const entry_t& b) const { return Compare()(a.first, b.first); }
+	};
+
+	std::vector<entry_t> _heap;
+	std::atomic<size_t> _size;
+	default_lock _sync;
+};
+
+// --- task callable ---
+
+// move-only replacement for std::function<void()>, callables up to inline_size bytes
+// are stored in place, bigger or over-aligned ones and ones that may throw while moving on the heap
+class task_function
 {
-class atomic_lock
+public:
+	static constexpr size_t inline_size = 40;
+	static constexpr size_t inline_align = alignof(uint64_t);
+
+	task_function() noexcept : _vtable(nullptr) {}
+
+	task_function(std::nullptr_t) noexcept : _vtable(nullptr) {}
+
+	template<typename F, typename = std::enable_if_t<
+		!std::is_same<std::decay_t<F>, task_function>::value
+	>> task_function(F&& func)
+		: _vtable(&ops_t<std::decay_t<F>>::table)
+	{
+		ops_t<std::decay_t<F>>::construct(&_storage, std::forward<F>(func));
+	}
+
+	task_function(const task_function&) = delete;
+	task_function& operator=(const task_function&) = delete;
+
+	task_function(task_function&& other) noexcept : _vtable(other._vtable)
+	{
+		if (_vtable != nullptr)
+			_vtable->move(&_storage, &other._storage);
+		other._vtable = nullptr;
+	}
+
+	task_function& operator=(task_function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			_vtable = other._vtable;
+			if (_vtable != nullptr)
+				_vtable->move(&_storage, &other._storage);
+			other._vtable = nullptr;
+		}
+		return *this;
+	}
+
+	task_function& operator=(std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
+
+	~task_function() { reset(); }
+
+	void operator()() { _vtable->invoke(&_storage); }
+
+	explicit operator bool() const noexcept { return _vtable != nullptr; }
+
+private:
+	struct vtable
+	{
+		void (*invoke)(void*);
+		void (*move)(void*, void*) noexcept; // leaves the source destroyed
+		void (*destroy)(void*) noexcept;
+	};
+
+	template<typename F> struct inline_ops
+	{
+		static F& get(void* storage) noexcept { return *static_cast<F*>(storage); }
+
+		template<typename Arg> static void construct(void* storage, Arg&& func)
+		{
+			new (storage) F(std::forward<Arg>(func));
+		}
+
+		static void invoke(void* storage) { get(storage)(); }
+
+		static void move(void* dest, void* src) noexcept
+		{
+			new (dest) F(std::move(get(src)));
+			get(src).~F();
+		}
+
+		static void destroy(void* storage) noexcept { get(storage).~F(); }
+
+		static const vtable table;
+	};
+
+	template<typename F> struct heap_ops
+	{
+		static F*& get(void* storage) noexcept { return *static_cast<F**>(storage); }
+
+		template<typename Arg> static void construct(void* storage, Arg&& func)
+		{
+			new (storage) F*(new F(std::forward<Arg>(func)));
+		}
+
+		static void invoke(void* storage) { (*get(storage))(); }
+
+		static void move(void* dest, void* src) noexcept { new (dest) F*(get(src)); }
+
+		static void destroy(void* storage) noexcept { delete get(storage); }
+
+		static const vtable table;
+	};
+
+	template<typename F> using ops_t = std::conditional_t<
+		sizeof(F) <= inline_size
+			&& alignof(F) <= inline_align
+			&& std::is_nothrow_move_constructible<F>::value,
+		inline_ops<F>,
+		heap_ops<F>
+	>;
+
+	std::aligned_storage_t<inline_size, inline_align> _storage;
+	const vtable* _vtable;
+
+	void reset() noexcept
+	{
+		if (_vtable != nullptr)
+			_vtable->destroy(&_storage);
+		_vtable = nullptr;
+	}
+};
+
+template<typename F> const task_function::vtable task_function::inline_ops<F>::table =
+	{ &inline_ops<F>::invoke, &inline_ops<F>::move, &inline_ops<F>::destroy };
+
+template<typename F> const task_function::vtable task_function::heap_ops<F>::table =
+	{ &heap_ops<F>::invoke, &heap_ops<F>::move, &heap_ops<F>::destroy };
+
+// --- task result ---
+
+// return value or exception of a finished task, kept in its record until the task_future lets go,
+// values up to inline_size bytes are stored in place, bigger ones on the heap
+class task_result
 {
 public:
-	explicit atomic_lock(std::atomic_flag& flag) noexcept
-		: _flag(flag)
+	static constexpr size_t inline_size = 24;
+	static constexpr size_t inline_align = alignof(uint64_t);
+
+	explicit task_result() noexcept : _destroy(nullptr) {}
+
+	task_result(const task_result&) = delete;
+	task_result(task_result&&) = delete;
+
+	task_result& operator=(const task_result&) = delete;
+	task_result& operator=(task_result&&) = delete;
+
+	~task_result() { reset(); }
+
+	template<typename T, typename Arg> void emplace(Arg&& value)
+	{
+		reset();
+		ops_t<T>::construct(&_storage, std::forward<Arg>(value));
+		_destroy = &ops_t<T>::destroy;
+	}
+
+	// T has to be the type given to emplace
+	template<typename T> T& get() noexcept { return ops_t<T>::get(&_storage); }
+
+	void set_exception(std::exception_ptr error) noexcept
 	{
-		// wait until the lock is free
-		while (_flag.test_and_set(std::memory_order_acq_rel));
+		static_assert(sizeof(std::exception_ptr) <= inline_size
+			&& alignof(std::exception_ptr) <= inline_align, "exception_ptr has to fit in place");
+
+		reset();
+		new (&_storage) std::exception_ptr(std::move(error));
+		_destroy = &destroy_exception;
 	}
 
-	atomic_lock(const atomic_lock&) = delete;
-	atomic_lock(atomic_lock&&) = delete;
+	bool has_exception() const noexcept { return _destroy == &destroy_exception; }
 
-	atomic_lock& operator= (const atomic_lock&) = delete;
-	atomic_lock& operator= (atomic_lock&&) = delete;
+	// only if has_exception()
+	const std::exception_ptr& exception() const noexcept
+	{
+		return *static_cast<const std::exception_ptr*>(static_cast<const void*>(&_storage));
+	}
 
-	~atomic_lock() noexcept
+	void reset() noexcept
 	{
-		// signal that the lock is free
-		_flag.clear(std::memory_order_release);
+		if (_destroy != nullptr)
+			_destroy(&_storage);
+		_destroy = nullptr;
 	}
 
 private:
-	std::atomic_flag& _flag;
+	template<typename T> struct inline_ops
+	{
+		static T& get(void* storage) noexcept { return *static_cast<T*>(storage); }
+
+		template<typename Arg> static void construct(void* storage, Arg&& value)
+		{
+			new (storage) T(std::forward<Arg>(value));
+		}
+
+		static void destroy(void* storage) noexcept { get(storage).~T(); }
+	};
+
+	template<typename T> struct heap_ops
+	{
+		static T& get(void* storage) noexcept { return **static_cast<T**>(storage); }
+
+		template<typename Arg> static void construct(void* storage, Arg&& value)
+		{
+			new (storage) T*(new T(std::forward<Arg>(value)));
+		}
+
+		static void destroy(void* storage) noexcept { delete *static_cast<T**>(storage); }
+	};
+
+	template<typename T> using ops_t = std::conditional_t<
+		sizeof(T) <= inline_size && alignof(T) <= inline_align,
+		inline_ops<T>,
+		heap_ops<T>
+	>;
+
+	std::aligned_storage_t<inline_size, inline_align> _storage;
+	void (*_destroy)(void*) noexcept; // also tells an exception apart from a value
+
+	static void destroy_exception(void* storage) noexcept
+	{
+		static_cast<std::exception_ptr*>(storage)->~exception_ptr();
+	}
 };
 
-class async_task
+// --- record storage ---
+
+// chunked pool of reusable entries, entries never move and are constructed only once,
+// so a stale index still points to a valid object and is detected by its owner
+template<typename T> class slab
 {
 public:
-	std::atomic_flag active_flag;
-	async_t::task_t task;
+	static constexpr uint32_t chunk_bits = 10;
+	static constexpr uint32_t chunk_size = 1u << chunk_bits;
+	static constexpr uint32_t max_chunks = 1u << 12;
 
-	// needed to prevent the std::future destructor from blocking
-	std::future<void> future;
+	explicit slab() noexcept : _chunk_count(0), _free_head(0)
+	{
+		for (auto& chunk : _chunks)
+			chunk.store(nullptr, std::memory_order_relaxed);
+	}
 
-	explicit async_task(async_t::task_t&&, std::vector<async_t::prereq>);
+	slab(const slab&) = delete;
+	slab(slab&&) = delete;
 
-	// no synchronization problems this way
-	async_task(const async_task&) = delete;
-	async_task(async_task&&) = delete;
+	slab& operator=(const slab&) = delete;
+	slab& operator=(slab&&) = delete;
 
-	async_task& operator=(const async_task&) = delete;
-	async_task& operator=(async_task&&) = delete;
+	~slab()
+	{
+		for (uint32_t i = 0; i < _chunk_count.load(std::memory_order_relaxed); ++i)
+			delete _chunks[i].load(std::memory_order_relaxed);
+	}
+
+	// lock-free unless the slab has to grow, throws std::length_error once it is full
+	uint32_t acquire()
+	{
+		while (true)
+		{
+			uint64_t head = _free_head.load(std::memory_order_acquire);
+			while (static_cast<uint32_t>(head) != 0)
+			{
+				const uint32_t index = static_cast<uint32_t>(head) - 1;
+				const uint64_t next = next_free(index).load(std::memory_order_relaxed);
+
+				// the upper half counts every change, so a reused head does not match
+				const uint64_t tag = (head >> 32) + 1;
+				if (_free_head.compare_exchange_weak(head, (tag << 32) | next,
+					std::memory_order_acquire, std::memory_order_acquire))
+					return index;
+			}
+			grow();
+		}
+	}
+
+	void release(const uint32_t index) noexcept
+	{
+		uint64_t head = _free_head.load(std::memory_order_relaxed);
+		uint64_t entry;
+		do
+		{
+			next_free(index).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+			entry = (((head >> 32) + 1) << 32) | (index + 1);
+		} while (!_free_head.compare_exchange_weak(head, entry,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// any index below capacity(), including free ones
+	T& operator[](const uint32_t index) noexcept
+	{
+		return _chunks[index >> chunk_bits].load(std::memory_order_acquire)->items[index & (chunk_size - 1)];
+	}
 
-	const std::vector<async_t::prereq>& prerequisites() const { return _prerequisites; }
+	size_t capacity() const noexcept
+	{
+		return static_cast<size_t>(_chunk_count.load(std::memory_order_acquire)) * chunk_size;
+	}
 
 private:
-	async_t::task_t init_task(async_t::task_t&&) noexcept;
+	struct chunk
+	{
+		std::unique_ptr<char[]> storage;
+		T* items;
+		std::atomic<uint32_t> next_free[chunk_size]; // index + 1 of the next free entry
+
+		explicit chunk(const uint32_t first_index)
+			: storage(new char[sizeof(T) * chunk_size + alignof(T)])
+		{
+			void* aligned = storage.get();
+			size_t space = sizeof(T) * chunk_size + alignof(T);
+			items = static_cast<T*>(std::align(alignof(T), sizeof(T) * chunk_size, aligned, space));
+
+			for (uint32_t i = 0; i < chunk_size; ++i)
+				new (items + i) T(first_index + i);
+		}
+
+		~chunk()
+		{
+			for (uint32_t i = 0; i < chunk_size; ++i)
+				items[i].~T();
+		}
+	};
+
+	std::atomic<chunk*> _chunks[max_chunks];
+	std::atomic<uint32_t> _chunk_count;
+	std::atomic<uint64_t> _free_head; // change count in the upper, index + 1 in the lower half
+	std::mutex _grow_sync;
+
+	std::atomic<uint32_t>& next_free(const uint32_t index) noexcept
+	{
+		return _chunks[index >> chunk_bits].load(std::memory_order_acquire)
+			->next_free[index & (chunk_size - 1)];
+	}
 
-	std::vector<async_t::prereq> _prerequisites;
+	void grow()
+	{
+		std::lock_guard<std::mutex> lock(_grow_sync);
+
+		// another thread may have grown the slab already
+		if (static_cast<uint32_t>(_free_head.load(std::memory_order_acquire)) != 0)
+			return;
+
+		const uint32_t count = _chunk_count.load(std::memory_order_relaxed);
+		if (count == max_chunks)
+			throw std::length_error("slab capacity exhausted");
+
+		_chunks[count].store(new chunk(count * chunk_size), std::memory_order_release);
+		_chunk_count.store(count + 1, std::memory_order_release);
+
+		for (uint32_t i = chunk_size; i > 0; --i)
+			release(count * chunk_size + i - 1);
+	}
+};
+}
+
+template<typename T> class task_future;
+
+class critical_path_scope;
+
+class task_graph;
+
+// what happens to the dependents of a task that threw
+enum class task_failure_policy
+{
+	cancel_dependents, // they are not run and report the same exception
+	run_dependents // they run as if the task had succeeded
+};
+
+struct task_queue_config
+{
+	size_t worker_count; // threads executing ready tasks
+	task_failure_policy failure_policy;
+
+	// every aging_interval-th look for work starts at the lowest priority, 0 turns it off
+	size_t aging_interval;
+
+	// binds every worker to one cpu, workers are spread evenly over the numa nodes either way
+	bool pin_workers;
+
+	explicit task_queue_config()
+		: worker_count(std::max(1u, std::thread::hardware_concurrency())),
+		failure_policy(task_failure_policy::cancel_dependents),
+		aging_interval(32),
+		pin_workers(false)
+	{}
+};
+
+enum class task_priority : uint8_t
+{
+	low, // runs when nothing else is ready, or when aging lets it go first
+	normal,
+	high // before any normal task, no matter which worker made it ready
+};
+
+// thrown by a task whose cancellation_token was cancelled, by wait and task_future::get of it and its dependents
+class task_cancelled : public std::runtime_error
+{
+public:
+	explicit task_cancelled() : std::runtime_error("task cancelled") {}
 };
+
+// shared by every copy, cancel() skips the tasks that did not start yet and
+// lets running ones find out through cancelled(), an empty token is never cancelled
+class cancellation_token
+{
+public:
+	explicit cancellation_token() noexcept : _state(nullptr) {}
+
+	cancellation_token(const cancellation_token& other) noexcept : _state(other._state) { acquire(); }
+
+	cancellation_token(cancellation_token&& other) noexcept : _state(other._state) { other._state = nullptr; }
+
+	cancellation_token& operator=(const cancellation_token& other) noexcept
+	{
+		cancellation_token copy(other);
+		std::swap(_state, copy._state);
+		return *this;
+	}
+
+	cancellation_token& operator=(cancellation_token&& other) noexcept
+	{
+		std::swap(_state, other._state);
+		return *this;
+	}
+
+	~cancellation_token() { release(); }
+
+	bool valid() const noexcept { return _state != nullptr; }
+
+	void cancel() const noexcept
+	{
+		if (_state != nullptr)
+			_state->cancelled.store(true, std::memory_order_release);
+	}
+
+	// cheap enough to poll in the inner loop of a running task
+	bool cancelled() const noexcept
+	{
+		return _state != nullptr && _state->cancelled.load(std::memory_order_acquire);
+	}
+
+	void throw_if_cancelled() const
+	{
+		if (cancelled())
+			throw task_cancelled();
+	}
+
+private:
+	friend cancellation_token make_cancellation_token();
+
+	// a single pointer, so a task guarded by a token still fits the inline storage of its record
+	struct state
+	{
+		std::atomic<bool> cancelled;
+		std::atomic<uint32_t> references;
+	};
+
+	state* _state;
+
+	void acquire() noexcept
+	{
+		if (_state != nullptr)
+			_state->references.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (_state != nullptr && _state->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete _state;
+	}
+};
+
+inline cancellation_token make_cancellation_token()
+{
+	cancellation_token token;
+	token._state = new cancellation_token::state{ { false }, { 1 } };
+	return token;
+}
+
+struct task_config
+{
+	using clock_t = std::chrono::steady_clock;
+
+	task_priority priority;
+
+	// ready tasks with a deadline go first, the earliest deadline before the others
+	clock_t::time_point deadline;
+
+	// estimated relative run time, weights the longest paths of a critical_path_scope
+	uint32_t cost;
+
+	// runs right after its last prerequisite on the same worker, for short continuations
+	bool inline_continuation;
+
+	// numa node of the task_queue whose workers should run the task, a hint for normal priority tasks,
+	// below task_queue::node_count(), adding the task throws std::invalid_argument otherwise
+	size_t node;
+	static constexpr size_t any_node = 0xFF;
+
+	// once cancelled the task is skipped if it did not start yet, its dependents are cancelled
+	// no matter the failure policy
+	cancellation_token token;
+
+	explicit task_config(const task_priority prio = task_priority::normal)
+		: priority(prio), deadline(clock_t::time_point::max()), cost(1), inline_continuation(false),
+		node(any_node)
+	{}
+
+	bool has_deadline() const { return deadline != clock_t::time_point::max(); }
+};
+
+// handles of the tasks added by one add_tasks call
+struct task_batch
+{
+	async_t::prereq group; // finished once every task of the batch finished
+	std::vector<async_t::prereq> tasks; // in the order of the callables
+
+	explicit task_batch(const async_t::prereq& group_handle) : group(group_handle) {}
+};
+
+class task_queue
+{
+public:
+	explicit task_queue();
+
+	explicit task_queue(const task_queue_config&);
+
+	task_queue(const task_queue&) = delete;
+	task_queue(task_queue&&) = delete;
+
+	task_queue& operator=(const task_queue&) = delete;
+	task_queue& operator=(task_queue&&) = delete;
+
+	~task_queue() noexcept;
+
+	async_t::prereq add_task(
+		const async_t::task_t&
+	);
+
+	async_t::prereq add_task(
+		const async_t::task_t&,
+		std::vector<async_t::prereq>
+	);
+
+	async_t::prereq add_task(
+		async_t::task_t&&
+	);
+
+	async_t::prereq add_task(
+		async_t::task_t&&,
+		std::vector<async_t::prereq>
+	);
+
+	// the callable is constructed in place, no std::function in between
+	template<typename F, typename = task_queue_util::enable_if_task_t<F>>
+	async_t::prereq add_task(F&&);
+
+	template<typename F, typename = task_queue_util::enable_if_task_t<F>>
+	async_t::prereq add_task(F&&, std::vector<async_t::prereq>);
+
+	// callables returning a value, the result is stored in the task record
+	template<typename F>
+	task_future<task_queue_util::enable_if_result_task_t<F>> add_task(F&&);
+
+	template<typename F>
+	task_future<task_queue_util::enable_if_result_task_t<F>> add_task(F&&, std::vector<async_t::prereq>);
+
+	// scheduled by the priority and deadline of the config, throws std::invalid_argument for an unknown node
+	template<typename F, typename = task_queue_util::enable_if_void_task_t<F>>
+	async_t::prereq add_task(F&&, std::vector<async_t::prereq>, const task_config&);
+
+	template<typename F>
+	task_future<task_queue_util::enable_if_result_task_t<F>> add_task(
+		F&&, std::vector<async_t::prereq>, const task_config&);
+
+	// adds every void() callable of the range in one go, the tasks share prerequisites and config,
+	// the prerequisites are linked once for the whole batch and the ready tasks are published together,
+	// the callables of an rvalue range are moved
+	template<typename Range>
+	task_batch add_tasks(Range&& callables,
+		std::vector<async_t::prereq> prerequisites = {}, const task_config& config = task_config());
+
+	// calls func(i) for every i in [begin, end), the range is split in halves down to grain
+	// indices and idle workers steal the halves, returns once all indices are done
+	template<typename F>
+	void parallel_for(const size_t begin, const size_t end, const size_t grain, F&& func);
+
+	// reduce(... reduce(reduce(identity, map(begin)), map(begin + 1)) ..., map(end - 1))
+	// reduce has to be associative, the order of the operands is kept
+	template<typename T, typename Map, typename Reduce>
+	T parallel_reduce(const size_t begin, const size_t end, const size_t grain,
+		T identity, Map&& map, Reduce&& reduce);
+
+	// runs func once the prereq finished, on the worker that finished it,
+	// returns a task_future if func returns a value
+	template<typename F>
+	auto then(const async_t::prereq&, F&&);
+
+	// finished once all prereqs finished
+	async_t::prereq when_all(std::vector<async_t::prereq>);
+
+	template<typename... Prereqs>
+	async_t::prereq when_all(const Prereqs&... prerequisites)
+	{
+		return when_all(std::vector<async_t::prereq>{ prerequisites... });
+	}
+
+	// finished once any of the prereqs finished, no matter if it failed
+	async_t::prereq when_any(std::vector<async_t::prereq>);
+
+	template<typename... Prereqs>
+	async_t::prereq when_any(const Prereqs&... prerequisites)
+	{
+		return when_any(std::vector<async_t::prereq>{ prerequisites... });
+	}
+
+	// rethrows the exception of the task, or the one it was cancelled with,
+	// the exception is kept until a wait on the task or wait_all reported it,
+	// called inside a task the worker runs other ready tasks until the prereq finished
+	void wait(const async_t::prereq&);
+
+	// rethrows the first exception of any task since the last wait_all, cancelled tasks are no error here,
+	// forgets the exceptions no wait reported,
+	// throws std::logic_error inside a task, it would wait for itself
+	void wait_all();
+
+	size_t worker_count() const { return _workers.size(); }
+
+	// numa nodes with workers, numbered in the order of the system node ids, 1 without numa
+	size_t node_count() const { return _node_tasks.size(); }
+
+	size_t worker_node(const size_t worker) const { return _worker_nodes[worker]; }
+
+	// task records ever allocated, finished records are reused
+	size_t task_capacity() const { return _records.capacity(); }
+
+private:
+	template<typename T> friend class task_future;
+	friend class critical_path_scope;
+	friend class task_graph;
+	friend struct task_queue_util::coroutine_access;
+
+	using lock_t = task_queue_util::default_lock;
+
+	std::atomic<bool> _active; // workers run while true
+	const task_failure_policy _failure_policy;
+	const size_t _aging_interval;
+
+	// a prereq is the generation and index of a record, records and edges are recycled
+	task_queue_util::slab<task_queue_util::async_task> _records;
+	task_queue_util::slab<task_queue_util::task_edge> _edges;
+	std::atomic<size_t> _unfinished_tasks;
+
+	// injection queue, tasks that became ready outside of a worker wait here,
+	// the worker holding _injection_sync is its consumer
+	task_queue_util::mpsc_queue _injected_tasks;
+	lock_t _injection_sync;
+
+	// tasks with a node hint that became ready away from their node, one lane per node
+	std::vector<std::unique_ptr<task_queue_util::mpsc_queue>> _node_tasks;
+	std::vector<size_t> _worker_nodes; // indexed like _workers
+	std::vector<std::vector<size_t>> _victims; // steal order per worker, same node first
+
+	// ready tasks that are not normal, the lanes are consumed under _injection_sync too
+	task_queue_util::mpsc_queue _high_tasks;
+	task_queue_util::mpsc_queue _low_tasks;
+
+	// ready tasks with a deadline, the earliest first
+	task_queue_util::ready_heap<task_config::clock_t::time_point, std::greater<task_config::clock_t::time_point>>
+		_deadline_tasks;
+
+	// ready normal tasks ranked by a critical_path_scope, the longest remaining path first
+	task_queue_util::ready_heap<uint32_t, std::less<uint32_t>> _ranked_tasks;
+
+	std::vector<std::thread> _workers;
+	std::vector<std::unique_ptr<task_queue_util::work_stealing_deque<task_queue_util::async_task>>>
+		_local_tasks; // one per worker, indexed like _workers
+
+	// idle workers and waiting threads park here, the epochs change on every wake up reason
+	std::mutex _park_mutex;
+	std::condition_variable _work_cv;
+	std::condition_variable _done_cv;
+	std::atomic<uint64_t> _work_epoch;
+	std::atomic<uint64_t> _done_epoch;
+	std::atomic<uint32_t> _sleeping_workers;
+	std::atomic<uint32_t> _waiting_threads;
+	std::atomic<uint32_t> _helping_workers; // waiting inside a task, subset of _waiting_threads
+
+	std::mutex _exception_sync;
+	std::exception_ptr _first_error; // reported and cleared by wait_all
+
+	struct failure
+	{
+		std::exception_ptr error; // nullptr if the task did not fail or the failure was reported
+		bool cancellation; // a task_cancelled
+	};
+
+	// exceptions of failed tasks by key, they outlive the records until wait or wait_all reported them
+	std::unordered_map<async_t::key_t, failure> _failures;
+	std::atomic<size_t> _failure_count; // size of _failures, checked without the lock
+
+	void worker_loop(const size_t);
+
+	task_queue_util::async_task* find_task(const size_t);
+
+	task_queue_util::async_task* find_normal_task(const size_t);
+
+	task_queue_util::async_task* pop_lane(task_queue_util::mpsc_queue&);
+
+	void run_task(task_queue_util::async_task*);
+
+	// enqueue and notify_work
+	void schedule(task_queue_util::async_task*);
+
+	// puts a ready task where the workers find it, without waking any
+	void enqueue(task_queue_util::async_task*);
+
+	void finish_task(task_queue_util::async_task*);
+
+	// throws std::invalid_argument for a node hint the queue does not have, before a record is taken
+	void check_config(const task_config&) const;
+
+	// forget drops the failure once it is reported
+	failure find_failure(const async_t::prereq&, const bool forget);
+
+	// whether the dependents of a task that failed with the exception are cancelled,
+	// the same for successors linked before and after the task finished
+	bool cancels_dependents(const bool cancellation) const;
+
+	// nullptr if the prereq is finished, otherwise the record is kept alive until released
+	task_queue_util::async_task* acquire_record(const async_t::prereq&);
+
+	void release_record(task_queue_util::async_task*);
+
+	void park_worker(const uint64_t);
+
+	// wakes one parked worker, or all of them for more than one new task
+	void notify_work(const size_t ready_count = 1);
+
+	// blocks until the predicate holds, a worker of this queue runs other ready tasks meanwhile
+	template<typename Pred> void wait_until(Pred);
+
+	template<typename Pred> void help_until(const size_t, Pred);
+
+	void finish_all_active_tasks();
+
+	async_t::prereq emplace_task(
+		task_queue_util::task_function&&,
+		std::vector<async_t::prereq>
+	);
+
+	// starts the task in a record taken from _records, the caller keeps
+	// references - 1 of the record references and releases them on its own,
+	// any_prerequisite makes the task ready once the first prerequisite finished
+	async_t::prereq emplace_task(
+		task_queue_util::async_task&,
+		task_queue_util::task_function&&,
+		std::vector<async_t::prereq>,
+		const uint32_t references,
+		const task_config&,
+		const bool any_prerequisite = false
+	);
+
+	// adds an edge to every prerequisite that did not finish yet
+	void link_prerequisites(task_queue_util::async_task&, const std::vector<async_t::prereq>&, const bool any_prerequisite);
+
+	// both records still hold their hold, so the predecessor can not finish meanwhile
+	void link_held(task_queue_util::async_task& predecessor, task_queue_util::async_task& successor);
+
+	task_batch emplace_batch(
+		std::vector<task_queue_util::task_function>&&,
+		std::vector<async_t::prereq>,
+		const task_config&
+	);
+
+	template<typename F>
+	task_future<task_queue_util::task_result_t<F>> add_value_task(
+		F&&, std::vector<async_t::prereq>, const task_config&);
+};
+
+namespace task_queue_util
+{
+// skips func with a task_cancelled exception once the token was cancelled
+template<typename F> auto guard_task(const cancellation_token& token, F&& func)
+{
+	return [token, func = std::forward<F>(func)]() mutable -> decltype(auto)
+	{
+		token.throw_if_cancelled();
+		return func();
+	};
+}
+
+// Chase-Lev deque, the owning worker pushes and pops at the bottom,
+// other workers steal from the top without taking a lock
+template<typename T> class work_stealing_deque
+{
+public:
+	explicit work_stealing_deque(const size_t capacity = 64)
+		: _top(0), _bottom(0), _array(new ring(capacity))
+	{
+		_retired.emplace_back(_array.load(std::memory_order_relaxed));
+	}
+
+	work_stealing_deque(const work_stealing_deque&) = delete;
+	work_stealing_deque(work_stealing_deque&&) = delete;
+
+	work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+	work_stealing_deque& operator=(work_stealing_deque&&) = delete;
+
+	// owner only
+	void push(T* item)
+	{
+		const int64_t bottom = _bottom.load(std::memory_order_relaxed);
+		const int64_t top = _top.load(std::memory_order_acquire);
+		ring* array = _array.load(std::memory_order_relaxed);
+
+		if (bottom - top > static_cast<int64_t>(array->mask))
+			array = grow(array, top, bottom);
+
+		array->store(bottom, item);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	// owner only, newest item or nullptr
+	T* pop()
+	{
+		const int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+		ring* array = _array.load(std::memory_order_relaxed);
+		_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = _top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			_bottom.store(bottom + 1, std::memory_order_relaxed); // was empty
+			return nullptr;
+		}
+
+		T* item = array->load(bottom);
+		if (top == bottom)
+		{
+			// last item, race against thieves for it
+			if (!_top.compare_exchange_strong(top, top + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed))
+				item = nullptr;
+			_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	// any thread, oldest item or nullptr if empty or another thief won
+	T* steal()
+	{
+		int64_t top = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom)
+			return nullptr;
+
+		T* item = _array.load(std::memory_order_acquire)->load(top);
+		if (!_top.compare_exchange_strong(top, top + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return item;
+	}
+
+	bool empty() const
+	{
+		return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct ring
+	{
+		const size_t mask;
+		std::unique_ptr<std::atomic<T*>[]> slots;
+
+		explicit ring(const size_t capacity) // capacity has to be a power of 2
+			: mask(capacity - 1), slots(new std::atomic<T*>[capacity])
+		{}
+
+		T* load(const int64_t index) const
+		{
+			return slots[static_cast<size_t>(index) & mask].load(std::memory_order_relaxed);
+		}
+
+		void store(const int64_t index, T* item)
+		{
+			slots[static_cast<size_t>(index) & mask].store(item, std::memory_order_relaxed);
+		}
+	};
+
+	std::atomic<int64_t> _top;
+	std::atomic<int64_t> _bottom;
+	std::atomic<ring*> _array;
+
+	// thieves may still read from an old ring, so all of them live as long as the deque
+	std::vector<std::unique_ptr<ring>> _retired;
+
+	ring* grow(ring* old, const int64_t top, const int64_t bottom)
+	{
+		ring* array = new ring((old->mask + 1) * 2);
+		for (int64_t i = top; i < bottom; ++i)
+			array->store(i, old->load(i));
+
+		_retired.emplace_back(array);
+		_array.store(array, std::memory_order_release);
+		return array;
+	}
+};
+
+struct task_edge
+{
+	const uint32_t index;
+	async_task* task; // the successor
+	task_edge* next;
+
+	explicit task_edge(const uint32_t slab_index) noexcept
+		: index(slab_index), task(nullptr), next(nullptr)
+	{}
+};
+
+// two cache lines on common platforms, reused for many tasks
+class alignas(64) async_task : public mpsc_hook
+{
+public:
+	const uint32_t index;
+
+	// unfinished prerequisites, plus one held by add_task until all edges are known,
+	// the highest bit is set once a failed prerequisite cancelled the task
+	std::atomic<uint32_t> pending;
+
+	task_function task;
+	task_result result; // empty for void tasks
+
+	task_config::clock_t::time_point deadline;
+	task_priority priority;
+	bool inline_continuation;
+	bool any_prerequisite; // every edge to the task holds a reference of it
+	uint8_t node; // task_config::any_node if the task has no node hint
+	uint32_t rank; // longest path to a sink, 0 if not ranked
+
+	explicit async_task(const uint32_t slab_index) noexcept;
+
+	// no synchronization problems this way
+	async_task(const async_task&) = delete;
+	async_task(async_task&&) = delete;
+
+	async_task& operator=(const async_task&) = delete;
+	async_task& operator=(async_task&&) = delete;
+
+	// called on a free record, returns the key of the new task,
+	// the running task holds one of the references
+	async_t::key_t start(task_function&&, const uint32_t references, const task_config&);
+
+	// for records a task_graph owns instead of a slab, the task stays and the owner keeps a reference
+	void restart(const uint32_t prerequisites) noexcept;
+
+	// fails if the generation does not match, the task is then finished
+	bool try_acquire(const uint32_t generation) noexcept;
+
+	// only while holding a reference
+	async_t::key_t key() const noexcept;
+
+	// true if this was the last reference, the record can then be reused
+	bool release() noexcept;
+
+	bool finished() const noexcept;
+
+	// false if this task already finished, the successor is then not linked
+	bool add_successor(task_edge*) noexcept;
+
+	// closes the successor list, later add_successor calls fail
+	task_edge* take_successors() noexcept;
+
+	// only while the task can not finish, successors may still be added meanwhile
+	const task_edge* peek_successors() const noexcept;
+
+	// removes one prerequisite, true if it was the last one
+	bool release_pending() noexcept;
+
+	// any_prerequisite tasks only, true if this made the task ready
+	bool fire() noexcept;
+
+	// only while holding a reference
+	void add_reference() noexcept;
+
+	// while the task did not start, the first failed prerequisite stores its exception
+	void cancel(const std::exception_ptr&, const bool cancellation) noexcept;
+
+	bool cancelled() const noexcept;
+
+	// stores the exception of the task, cancellation if it is a task_cancelled
+	void fail(std::exception_ptr, const bool cancellation) noexcept;
+
+	// only once the task failed, so the exception type is known without a rethrow
+	bool cancellation() const noexcept;
+
+	// restarted by its owner, finishing it keeps the task
+	bool persistent() const noexcept;
+
+	// 1 once only the owner of a persistent record holds it, nothing touches it afterwards
+	uint32_t references() const noexcept;
+
+private:
+	std::atomic<task_edge*> _successors;
+
+	// generation in the upper, reference count in the lower half
+	std::atomic<uint64_t> _generation_refs;
+
+	static task_edge* closed() noexcept;
+
+	static constexpr uint32_t cancelled_flag = 1u << 31;
+	static constexpr uint32_t fired_flag = 1u << 30;
+	static constexpr uint32_t cancellation_flag = 1u << 29;
+	static constexpr uint32_t persistent_flag = 1u << 28;
+};
+
+// shared by the pieces of one parallel_for, the thread that split off a piece runs it
+// itself if no worker started it yet, the task of a piece that lost this race does nothing
+template<typename Body> class parallel_range : public std::enable_shared_from_this<parallel_range<Body>>
+{
+public:
+	explicit parallel_range(task_queue& queue, const size_t size, const size_t grain, Body& body)
+		:
+		_queue(queue),
+		_grain(grain),
+		_body(body),
+		_piece_count(0),
+		_claimed(new std::atomic<bool>[size / grain * 2 + 1]()) // halving leaves pieces above grain / 2
+	{}
+
+	parallel_range(const parallel_range&) = delete;
+	parallel_range(parallel_range&&) = delete;
+
+	parallel_range& operator=(const parallel_range&) = delete;
+	parallel_range& operator=(parallel_range&&) = delete;
+
+	// returns once the whole range is done, rethrows the first exception of the body
+	void run(size_t begin, size_t end);
+
+private:
+	struct piece
+	{
+		size_t begin;
+		size_t end;
+		size_t id;
+		async_t::key_t key;
+	};
+
+	task_queue& _queue;
+	const size_t _grain;
+	Body& _body;
+
+	std::atomic<size_t> _piece_count;
+	std::unique_ptr<std::atomic<bool>[]> _claimed;
+
+	// set by pieces run on workers, they do not fail as tasks
+	std::mutex _error_sync;
+	std::exception_ptr _error;
+
+	bool claim(const size_t id) noexcept { return !_claimed[id].exchange(true, std::memory_order_acq_rel); }
+
+	void fail(std::exception_ptr error)
+	{
+		std::lock_guard<std::mutex> lock(_error_sync);
+		if (!_error)
+			_error = std::move(error);
+	}
+};
+}
+
+// result of a task added with a callable returning T, converts to the prereq of that task,
+// the value stays in the task record until get() took it or the future is destroyed,
+// a task_future must not outlive its task_queue
+template<typename T> class task_future
+{
+public:
+	explicit task_future() noexcept : _queue(nullptr), _record(nullptr), _handle(async_t::key_t(0)) {}
+
+	task_future(const task_future&) = delete;
+	task_future& operator=(const task_future&) = delete;
+
+	task_future(task_future&& other) noexcept
+		: _queue(other._queue), _record(other._record), _handle(other._handle)
+	{
+		other._record = nullptr;
+	}
+
+	task_future& operator=(task_future&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			_queue = other._queue;
+			_record = other._record;
+			_handle = other._handle;
+			other._record = nullptr;
+		}
+		return *this;
+	}
+
+	~task_future() { reset(); }
+
+	// false once get() was called
+	bool valid() const noexcept { return _record != nullptr; }
+
+	bool ready() const noexcept;
+
+	void wait() const;
+
+	// blocks until the task finished, afterwards the future is no longer valid,
+	// rethrows the exception of the task
+	T get();
+
+	operator async_t::prereq() const noexcept { return _handle; }
+
+private:
+	friend class task_queue;
+	friend struct task_queue_util::coroutine_access;
+
+	task_queue* _queue;
+	task_queue_util::async_task* _record; // one reference held while valid
+	async_t::prereq _handle;
+
+	explicit task_future(task_queue* queue, task_queue_util::async_task* record, const async_t::prereq& handle) noexcept
+		: _queue(queue), _record(record), _handle(handle)
+	{}
+
+	void reset() noexcept
+	{
+		if (_record != nullptr)
+			_queue->release_record(_record);
+		_record = nullptr;
+	}
+};
+
+// holds back the tasks this thread adds to the queue, once the scope closes every task is ranked
+// by the cost of its longest path to a sink and ready tasks with the highest rank run first,
+// no task of the scope starts before it closed, so none of them may be waited for inside it
+class critical_path_scope
+{
+public:
+	explicit critical_path_scope(task_queue&);
+
+	critical_path_scope(const critical_path_scope&) = delete;
+	critical_path_scope(critical_path_scope&&) = delete;
+
+	critical_path_scope& operator=(const critical_path_scope&) = delete;
+	critical_path_scope& operator=(critical_path_scope&&) = delete;
+
+	// releases the tasks
+	~critical_path_scope();
+
+private:
+	friend class task_queue;
+
+	task_queue& _queue;
+	critical_path_scope* _outer; // scopes nest per thread
+	std::vector<std::pair<task_queue_util::async_task*, uint32_t>> _tasks; // with their cost, in submission order
+};
+
+// a dag that is built and validated once and then run many times, a run only
+// resets the dependency counters and adds the nodes as plain tasks once they are ready
+class task_graph
+{
+public:
+	using node_t = size_t;
+
+	explicit task_graph() noexcept;
+
+	task_graph(const task_graph&) = delete;
+	task_graph(task_graph&&) = delete;
+
+	task_graph& operator=(const task_graph&) = delete;
+	task_graph& operator=(task_graph&&) = delete;
+
+	~task_graph();
+
+	template<typename F, typename = task_queue_util::enable_if_void_task_t<F>>
+	node_t add_node(F&&);
+
+	// after runs before, nodes and edges can not change during a run
+	void add_edge(const node_t before, const node_t after);
+
+	size_t size() const { return _nodes.size(); }
+
+	// false if the edges contain a cycle
+	bool validate();
+
+	// blocks until every node ran, one run at a time, once a node threw
+	// the nodes that did not start yet are skipped and the exception is rethrown,
+	// the records of the nodes are built once, a run only restarts them
+	void run(task_queue&);
+
+private:
+	std::vector<task_queue_util::task_function> _nodes;
+	std::vector<std::pair<node_t, node_t>> _edges;
+
+	// compiled by validate, the successors of node i are _successors[_offsets[i]] to _successors[_offsets[i + 1]]
+	bool _compiled;
+	bool _valid;
+	std::vector<size_t> _offsets;
+	std::vector<node_t> _successors;
+	std::vector<node_t> _roots;
+	std::vector<uint32_t> _prerequisite_counts;
+
+	// one record per node, built by validate, they never go to a slab and keep their task between runs
+	std::unique_ptr<char[]> _task_storage;
+	task_queue_util::async_task* _tasks;
+	size_t _task_count;
+
+	// state of the current run
+	task_queue* _queue;
+	std::atomic<size_t> _remaining;
+	std::atomic<bool> _failed;
+	std::mutex _error_sync;
+	std::exception_ptr _error;
+
+	void build_tasks();
+
+	void destroy_tasks() noexcept;
+
+	void execute(const node_t);
+};
+
+// ----- IMPLEMENTATION -----
+
+template<typename F, typename> async_t::prereq task_queue::add_task(F&& func)
+{
+	return emplace_task(task_queue_util::task_function(std::forward<F>(func)), {});
+}
+
+template<typename F, typename> async_t::prereq task_queue::add_task(
+	F&& func,
+	std::vector<async_t::prereq> prerequisites
+)
+{
+	return emplace_task(task_queue_util::task_function(std::forward<F>(func)), std::move(prerequisites));
+}
+
+template<typename F> task_future<task_queue_util::enable_if_result_task_t<F>> task_queue::add_task(F&& func)
+{
+	return add_task(std::forward<F>(func), {}, task_config());
+}
+
+template<typename F> task_future<task_queue_util::enable_if_result_task_t<F>> task_queue::add_task(
+	F&& func,
+	std::vector<async_t::prereq> prerequisites
+)
+{
+	return add_task(std::forward<F>(func), std::move(prerequisites), task_config());
+}
+
+template<typename F, typename> async_t::prereq task_queue::add_task(
+	F&& func,
+	std::vector<async_t::prereq> prerequisites,
+	const task_config& config
+)
+{
+	check_config(config);
+
+	// only tasks with a token pay for the check
+	if (config.token.valid())
+	{
+		return emplace_task(
+			_records[_records.acquire()],
+			task_queue_util::task_function(task_queue_util::guard_task(config.token, std::forward<F>(func))),
+			std::move(prerequisites),
+			1,
+			config
+		);
+	}
+
+	return emplace_task(
+		_records[_records.acquire()],
+		task_queue_util::task_function(std::forward<F>(func)),
+		std::move(prerequisites),
+		1,
+		config
+	);
+}
+
+template<typename F> task_future<task_queue_util::enable_if_result_task_t<F>> task_queue::add_task(
+	F&& func,
+	std::vector<async_t::prereq> prerequisites,
+	const task_config& config
+)
+{
+	check_config(config);
+
+	if (config.token.valid())
+		return add_value_task(task_queue_util::guard_task(config.token, std::forward<F>(func)), std::move(prerequisites), config);
+	return add_value_task(std::forward<F>(func), std::move(prerequisites), config);
+}
+
+template<typename F> task_future<task_queue_util::task_result_t<F>> task_queue::add_value_task(
+	F&& func,
+	std::vector<async_t::prereq> prerequisites,
+	const task_config& config
+)
+{
+	using result_t = task_queue_util::task_result_t<F>;
+
+	// the future holds the second reference, so the record and its result outlive the task
+	auto& record = _records[_records.acquire()];
+	const auto handle = emplace_task(
+		record,
+		[func = std::forward<F>(func), &record]() mutable -> void
+		{ record.result.template emplace<result_t>(func()); },
+		std::move(prerequisites),
+		2,
+		config
+	);
+
+	return task_future<result_t>(this, &record, handle);
+}
+
+template<typename Range> task_batch task_queue::add_tasks(
+	Range&& callables,
+	std::vector<async_t::prereq> prerequisites,
+	const task_config& config
+)
+{
+	using iterator_t = decltype(std::begin(callables));
+	using category_t = typename std::iterator_traits<iterator_t>::iterator_category;
+	static_assert(std::is_void<task_queue_util::task_result_t<decltype(*std::begin(callables))>>::value,
+		"add_tasks takes void() callables");
+
+	check_config(config);
+
+	std::vector<task_queue_util::task_function> tasks;
+	if (std::is_base_of<std::forward_iterator_tag, category_t>::value)
+		tasks.reserve(static_cast<size_t>(std::distance(std::begin(callables), std::end(callables))));
+
+	for (auto& func : callables)
+	{
+		if (config.token.valid())
+			tasks.emplace_back(task_queue_util::guard_task(config.token, task_queue_util::forward_element<Range>(func)));
+		else
+			tasks.emplace_back(task_queue_util::forward_element<Range>(func));
+	}
+
+	return emplace_batch(std::move(tasks), std::move(prerequisites), config);
+}
+
+template<typename F> void task_queue::parallel_for(
+	const size_t begin,
+	const size_t end,
+	const size_t grain,
+	F&& func
+)
+{
+	if (begin >= end)
+		return;
+
+	auto body = [&func](const size_t first, const size_t last) -> void
+	{
+		for (size_t i = first; i < last; ++i)
+			func(i);
+	};
+
+	const size_t min_size = std::max<size_t>(grain, 1);
+	std::make_shared<task_queue_util::parallel_range<decltype(body)>>(*this, end - begin, min_size, body)
+		->run(begin, end);
+}
+
+template<typename T, typename Map, typename Reduce> T task_queue::parallel_reduce(
+	const size_t begin,
+	const size_t end,
+	const size_t grain,
+	T identity,
+	Map&& map,
+	Reduce&& reduce
+)
+{
+	if (begin >= end)
+		return identity;
+
+	// one partial result per piece, combined in range order at the end
+	std::mutex partials_sync;
+	std::vector<std::pair<size_t, T>> partials;
+
+	auto body = [&](const size_t first, const size_t last) -> void
+	{
+		T partial = identity;
+		for (size_t i = first; i < last; ++i)
+			partial = reduce(std::move(partial), map(i));
+
+		std::lock_guard<std::mutex> lock(partials_sync);
+		partials.emplace_back(first, std::move(partial));
+	};
+
+	const size_t min_size = std::max<size_t>(grain, 1);
+	std::make_shared<task_queue_util::parallel_range<decltype(body)>>(*this, end - begin, min_size, body)
+		->run(begin, end);
+
+	std::sort(partials.begin(), partials.end(),
+		[](const std::pair<size_t, T>& a, const std::pair<size_t, T>& b) { return a.first < b.first; });
+
+	for (auto& partial : partials)
+		identity = reduce(std::move(identity), std::move(partial.second));
+	return identity;
+}
+
+template<typename Body> void task_queue_util::parallel_range<Body>::run(size_t begin, size_t end)
+{
+	piece pieces[sizeof(size_t) * 8]; // one per halving
+	size_t count = 0;
+	std::exception_ptr error;
+
+	try
+	{
+		// split off the upper halves, the biggest one is the oldest and so the first to be stolen
+		while (end - begin > _grain)
+		{
+			const size_t middle = begin + (end - begin) / 2;
+			const size_t id = _piece_count.fetch_add(1, std::memory_order_relaxed);
+
+			auto self = this->shared_from_this();
+			const auto handle = _queue.add_task([self, middle, end, id]() -> void
+			{
+				if (!self->claim(id))
+					return;
+
+				try
+				{
+					self->run(middle, end);
+				}
+				catch (...)
+				{
+					self->fail(std::current_exception());
+				}
+			});
+
+			pieces[count++] = { middle, end, id, handle.key() };
+			end = middle;
+		}
+
+		_body(begin, end);
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	// run the pieces nobody started yet, wait for the others, newest first
+	while (count > 0)
+	{
+		const auto& split = pieces[--count];
+		try
+		{
+			if (claim(split.id))
+			{
+				if (!error)
+					run(split.begin, split.end);
+			}
+			else
+				_queue.wait(async_t::prereq(split.key));
+		}
+		catch (...)
+		{
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+
+	if (!error)
+	{
+		std::lock_guard<std::mutex> lock(_error_sync);
+		error = _error;
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+template<typename F, typename> task_graph::node_t task_graph::add_node(F&& func)
+{
+	_nodes.emplace_back(std::forward<F>(func));
+	_compiled = false;
+	return _nodes.size() - 1;
+}
+
+template<typename F> auto task_queue::then(const async_t::prereq& prerequisite, F&& func)
+{
+	task_config config;
+	config.inline_continuation = true;
+	return add_task(std::forward<F>(func), { prerequisite }, config);
+}
+
+template<typename T> bool task_future<T>::ready() const noexcept
+{
+	return _record == nullptr || _record->finished();
+}
+
+template<typename T> void task_future<T>::wait() const
+{
+	if (_record != nullptr)
+		_queue->wait(_handle);
+}
+
+template<typename T> T task_future<T>::get()
+{
+	if (_record == nullptr)
+		throw std::logic_error("task_future has no result");
+
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+		reset();
+		throw;
+	}
+
+	T value(std::move(_record->result.template get<T>()));
+	reset();
+	return value;
 }
 
 }
@@ -16,6 +16,7 @@
 #include <algorithm>
 #include <string>
 #include <tuple>
+#include <unordered_set>
 #include <cassert>
 
 #include <chrono>
@@ -84,6 +85,11 @@ public:
 
 	void render_results();
 
+	// comma separated category, test, size and time rows for further processing
+	void write_results(std::ostream&) const;
+
+	const std::vector<result_t>& results() const { return _results; }
+
 private:
 	std::tuple<TestCategorys...> _categorys;
 	
@@ -120,10 +126,16 @@ public:
 	result_t& operator= (result_t&&) = default;
 };
 
-template<typename Func> class test
+// default setup, does nothing
+struct no_setup
+{
+	void operator() (const size_t) const { }
+};
+
+template<typename Func, typename Setup = no_setup> class test
 {
 public:
-	explicit test(const std::string&, Func&&);
+	explicit test(const std::string&, Func&&, Setup&& = Setup());
 
 	test(const test&) = default;
 	test(test&&) = default;
@@ -140,6 +152,7 @@ public:
 
 private:
 	Func _func;
+	Setup _setup; // called untimed before every repetition
 	std::string _name;
 	bool _visible;
 
@@ -234,17 +247,19 @@ void for_each_in_tuple(std::tuple<Ts...>& tuple, F func)
 
 // --- test ---
 
-template<typename T> test<T>::test(
+template<typename T, typename S> test<T, S>::test(
 	const std::string& name,
-	T&& func
+	T&& func,
+	S&& setup
 )
 	:
 	_name(name),
 	_func(std::forward<T>(func)),
+	_setup(std::forward<S>(setup)),
 	_visible(true)
 { }
 
-template<typename T> inline test_suit_util::point_t test<T>::stop_timer(
+template<typename T, typename S> inline test_suit_util::point_t test<T, S>::stop_timer(
 	const std::chrono::high_resolution_clock::time_point& start,
 	const size_t iterations,
 	const size_t repetitions
@@ -259,15 +274,32 @@ template<typename T> inline test_suit_util::point_t test<T>::stop_timer(
 	return{ static_cast<int64_t>(iterations), delta_time };
 }
 
-template<typename T> test_suit_util::point_t test<T>::run_test(
+template<typename T, typename S> test_suit_util::point_t test<T, S>::run_test(
 	const size_t size,
 	const size_t repetitions
 )
 {
-	auto start = start_timer();
+	if (std::is_same<S, no_setup>::value)
+	{
+		auto start = start_timer();
+		for (size_t i = 0; i < repetitions; ++i)
+			_func(size);
+		return stop_timer(start, size, repetitions);
+	}
+
+	// only the time spent in _func counts
+	assert(repetitions != 0 && "Repeating task 0 times!");
+	int64_t delta_time = {};
 	for (size_t i = 0; i < repetitions; ++i)
+	{
+		_setup(size);
+		auto start = start_timer();
 		_func(size);
-	return stop_timer(start, size, repetitions);
+		delta_time += std::chrono::duration_cast<std::chrono::nanoseconds>
+			(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	return{ static_cast<int64_t>(size), delta_time / static_cast<int64_t>(repetitions) };
 }
 
 // --- test_category ---
@@ -462,6 +494,21 @@ template<typename... Ts> void test_suit<Ts...>::render_category(
 	}
 }
 
+template<typename... Ts> void test_suit<Ts...>::write_results(
+	std::ostream& output
+) const
+{
+	output << "category,test,size,nanoseconds\n";
+	for (const auto& result : _results)
+		for (const auto& plot : result.graph)
+			for (const auto& point : plot.points())
+				output
+					<< result.category_name << ','
+					<< plot.name() << ','
+					<< point.first << ','
+					<< point.second << '\n';
+}
+
 template<typename... Ts> void test_suit<Ts...>::render_results()
 {
 	for (const auto& result : _results)
@@ -489,6 +536,17 @@ template<typename T> test_suit_util::test<T> make_test(
 	return test_suit_util::test<T>(testName, std::forward<T>(func));
 }
 
+template<typename T, typename S> test_suit_util::test<T, S> make_test(
+	const std::string& testName, T func, S setup
+)
+{
+	return test_suit_util::test<T, S>(
+		testName,
+		std::forward<T>(func),
+		std::forward<S>(setup)
+	);
+}
+
 template<typename... Ts> test_suit_util::test_category<Ts...>make_test_category(
 	const std::string& categoryName, Ts&&... tests
 )
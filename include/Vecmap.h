@@ -13,6 +13,16 @@
 #include <algorithm>
 #include <iterator>
 #include <memory>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+#include <cassert>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#endif
 
 namespace vool
 {
@@ -24,6 +34,23 @@ template<typename K, typename V> class ref_bucket;
 template<typename K, typename V> class val_bucket;
 }
 
+// buckets ahead of the current one whose value gets prefetched during traversal
+constexpr size_t default_prefetch_distance = 8;
+
+struct vec_map_stats
+{
+	size_t bucket_bytes; // whole bucket vector allocation
+	size_t value_heap_bytes; // out of line ref_bucket values
+	size_t index_bytes; // hash index of hash_vec_map
+	size_t slack_bytes; // allocated but unused bucket capacity
+	size_t duplicate_count; // buckets whose key is already held by another bucket
+	size_t sort_count; // sorts of the bucket vector
+	size_t lazy_sort_count; // sorts triggered by access to an unsorted map
+	std::chrono::nanoseconds sort_time; // total time spent sorting
+
+	size_t total_bytes() const { return bucket_bytes + value_heap_bytes + index_bytes; }
+};
+
 template<typename K, typename V> class vec_map
 {
 public:
@@ -57,6 +84,9 @@ public:
 
 	void sort();
 
+	// sorts only if unsorted, counted as lazy sort
+	void lazy_sort();
+
 	void reserve(const size_t);
 
 	void shrink_to_fit();
@@ -68,6 +98,8 @@ public:
 
 	V& at(const K&);
 
+	bucket_it_t find(const K&);
+
 	// erase elements
 	void erase(const K&);
 
@@ -95,6 +127,14 @@ public:
 	const auto crbegin() const { return _buckets.crbegin(); }
 	const auto crend() const { return _buckets.crend(); }
 
+	// traversal in bucket order, ref_bucket values are prefetched ahead
+	template<typename Func> void for_each_value(Func, const size_t = default_prefetch_distance);
+
+	template<typename Func> void for_each(Func, const size_t = default_prefetch_distance);
+
+	// sort and allocate ref_bucket values anew in key order, so traversal reads them sequentially
+	void relayout();
+
 	// modifiers
 	auto& get_internal_vec() { return _buckets; }
 
@@ -107,8 +147,13 @@ public:
 
 	bool is_sorted() const { return _is_sorted; }
 
+	vec_map_stats memory_stats() const;
+
 private:
 	bool _is_sorted;
+	size_t _sort_count;
+	size_t _lazy_sort_count;
+	std::chrono::nanoseconds _sort_time;
 
 	std::vector<bucket_t> _buckets;
 };
@@ -135,6 +180,9 @@ public:
 
 	const K& key() const { return _key; }
 
+	// replaces the value allocation, returns the previous one
+	std::unique_ptr<V> exchange_value(std::unique_ptr<V>);
+
 	bool operator< (const K& comp) const { return _key < comp; }
 	bool operator< (const ref_bucket& comp) const { return _key < comp._key; }
 
@@ -171,8 +219,199 @@ private:
 	K _key;
 	V _value;
 };
+
+// size ratio at which linear stepping through the larger map is replaced by galloping
+constexpr size_t gallop_ratio = 16;
+
+template<typename K, typename V> class join_iterator
+{
+public:
+	using bucket_t = typename vec_map<K, V>::bucket_t;
+	using bucket_it_t = typename vec_map<K, V>::bucket_it_t;
+
+	using iterator_category = std::input_iterator_tag;
+	using value_type = std::pair<bucket_t&, bucket_t&>;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = value_type;
+
+	explicit join_iterator(
+		const bucket_it_t,
+		const bucket_it_t,
+		const bucket_it_t,
+		const bucket_it_t
+	);
+
+	reference operator* () const { return { *_a_it, *_b_it }; }
+
+	join_iterator& operator++ ();
+
+	join_iterator operator++ (int);
+
+	bool operator== (const join_iterator& other) const { return _a_it == other._a_it; }
+	bool operator!= (const join_iterator& other) const { return _a_it != other._a_it; }
+
+private:
+	bucket_it_t _a_it;
+	bucket_it_t _a_end;
+	bucket_it_t _b_it;
+	bucket_it_t _b_end;
+	bool _gallop_a;
+	bool _gallop_b;
+
+	void seek();
+};
+
+template<typename K, typename V> class join_range
+{
+public:
+	explicit join_range(join_iterator<K, V> first, join_iterator<K, V> last)
+		: _first(first), _last(last)
+	{ }
+
+	join_iterator<K, V> begin() const { return _first; }
+	join_iterator<K, V> end() const { return _last; }
+
+private:
+	join_iterator<K, V> _first;
+	join_iterator<K, V> _last;
+};
 }
 
+// set algebra: one linear pass over both maps, keys are expected to be unique
+template<typename K, typename V, typename Resolve> vec_map<K, V> merge(
+	vec_map<K, V>&,
+	vec_map<K, V>&,
+	Resolve
+);
+
+template<typename K, typename V> vec_map<K, V> intersect(
+	vec_map<K, V>&,
+	vec_map<K, V>&
+);
+
+template<typename K, typename V, typename Resolve> vec_map<K, V> intersect(
+	vec_map<K, V>&,
+	vec_map<K, V>&,
+	Resolve
+);
+
+template<typename K, typename V> vec_map<K, V> difference(
+	vec_map<K, V>&,
+	vec_map<K, V>&
+);
+
+// zipped iteration over all buckets whose key is present in both maps
+template<typename K, typename V> vec_map_util::join_range<K, V> join(
+	vec_map<K, V>&,
+	vec_map<K, V>&
+);
+
+namespace vec_map_util
+{
+struct index_entry
+{
+	uint32_t slot; // position in the bucket vector
+	uint32_t tag; // upper hash bits, home position and cheap key pre compare
+};
+}
+
+// buckets stay in insertion order, lookups go through an open addressing index
+template<typename K, typename V, typename Hash = std::hash<K>> class hash_vec_map
+{
+public:
+	using bucket_t = typename vec_map<K, V>::bucket_t;
+	using bucket_it_t = typename std::vector<bucket_t>::iterator;
+
+	explicit hash_vec_map();
+
+	hash_vec_map(std::initializer_list<bucket_t>);
+
+	hash_vec_map(const hash_vec_map&) = default;
+	hash_vec_map(hash_vec_map&&) = default;
+
+	hash_vec_map& operator= (const hash_vec_map&) = default;
+	hash_vec_map& operator= (hash_vec_map&&) = default;
+
+	~hash_vec_map() noexcept { }
+
+	// insert, an already present key gets its value replaced
+	void insert(const K& key, const V&);
+
+	void insert(const bucket_t&);
+
+	void insert(
+		const bucket_it_t,
+		const bucket_it_t
+	);
+
+	void reserve(const size_t);
+
+	void shrink_to_fit();
+
+	void clear();
+
+	// value access
+	V& operator[] (const K&);
+
+	V& at(const K&);
+
+	bucket_it_t find(const K&);
+
+	// erase element: the last bucket takes the place of the erased one
+	void erase(const K&);
+
+	// iterators
+	auto begin() { return _buckets.begin(); }
+	auto end() { return _buckets.end(); }
+
+	const auto cbegin() const { return _buckets.cbegin(); }
+	const auto cend() const { return _buckets.cend(); }
+
+	// traversal in insertion order, ref_bucket values are prefetched ahead
+	template<typename Func> void for_each_value(Func, const size_t = default_prefetch_distance);
+
+	template<typename Func> void for_each(Func, const size_t = default_prefetch_distance);
+
+	// allocate ref_bucket values anew in insertion order, so traversal reads them sequentially
+	void relayout();
+
+	// modifiers
+	const auto& get_internal_vec_const() const { return _buckets; }
+
+	// capacity
+	size_t size() const { return _buckets.size(); }
+
+	size_t capacity() const { return _buckets.capacity(); }
+
+	size_t index_capacity() const { return _index.size(); }
+
+	vec_map_stats memory_stats() const;
+
+private:
+	static constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+	static constexpr size_t min_index_size = 8;
+
+	std::vector<bucket_t> _buckets;
+	std::vector<vec_map_util::index_entry> _index;
+	uint32_t _tag_shift; // tag >> _tag_shift is the home position
+	Hash _hash;
+
+	uint32_t tag(const K&) const;
+
+	size_t mask() const { return _index.size() - 1; }
+
+	size_t home(const uint32_t t) const { return t >> _tag_shift; }
+
+	size_t find_position(const K&, const uint32_t) const; // _index.size() if not present
+
+	void index_insert(const vec_map_util::index_entry);
+
+	void index_erase(size_t);
+
+	void rebuild_index(const size_t);
+};
+
 // ----- IMPLEMENTATION -----
 
 
@@ -208,6 +447,87 @@ template<typename K, typename V> ref_bucket<K, V>& ref_bucket<K, V>::operator= (
 	return *this;
 }
 
+template<typename K, typename V> std::unique_ptr<V> ref_bucket<K, V>::exchange_value(
+	std::unique_ptr<V> value
+)
+{
+	std::swap(_value, value);
+	return value;
+}
+
+// --- statistics ---
+
+template<typename Bucket> struct value_heap_size
+{
+	static constexpr size_t value = 0;
+};
+
+template<typename K, typename V> struct value_heap_size<ref_bucket<K, V>>
+{
+	static constexpr size_t value = sizeof(V);
+};
+
+// --- traversal ---
+
+inline void prefetch(const void* address)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(address);
+#else
+	static_cast<void>(address);
+#endif
+}
+
+template<typename K, typename V> void prefetch_value(const ref_bucket<K, V>& bucket)
+{
+	prefetch(std::addressof(bucket.value()));
+}
+
+template<typename K, typename V> void prefetch_value(const val_bucket<K, V>&)
+{
+	// value is stored inline, the sequential bucket walk is already prefetcher friendly
+}
+
+template<typename It, typename Func> void for_each_bucket(
+	const It first,
+	const It last,
+	Func func,
+	const size_t distance
+)
+{
+	// software prefetch distance buckets ahead, each step would otherwise wait for memory
+	const auto size = static_cast<size_t>(std::distance(first, last));
+	const auto head = std::min(distance, size);
+
+	for (size_t i = 0; i < head; ++i)
+		prefetch_value(first[i]);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (i + distance < size)
+			prefetch_value(first[i + distance]);
+		func(first[i]);
+	}
+}
+
+template<typename K, typename V> void relayout_values(std::vector<ref_bucket<K, V>>& buckets)
+{
+	// all new allocations happen before any old one is freed,
+	// otherwise the allocator would hand the freed blocks right back in scattered order
+	std::vector<std::unique_ptr<V>> old_values;
+	old_values.reserve(buckets.size());
+
+	for (auto& bucket : buckets)
+		old_values.push_back(bucket.exchange_value(std::make_unique<V>(std::move(bucket.value()))));
+}
+
+template<typename K, typename V> void relayout_values(std::vector<val_bucket<K, V>>&)
+{
+	// values are already stored in bucket order
+}
+
 // --- val_bucket ---
 
 template<typename K, typename V> val_bucket<K, V>::val_bucket(
@@ -224,13 +544,19 @@ template<typename K, typename V> val_bucket<K, V>::val_bucket(
 // --- vec_map ---
 
 template<typename K, typename V> vec_map<K, V>::vec_map() :
-	_is_sorted(true)
+	_is_sorted(true),
+	_sort_count(0),
+	_lazy_sort_count(0),
+	_sort_time(0)
 { }
 
 template<typename K, typename V> vec_map<K, V>::vec_map(
 	std::initializer_list<bucket_t> init
 ) :
 	_is_sorted(false),
+	_sort_count(0),
+	_lazy_sort_count(0),
+	_sort_time(0),
 	_buckets(init.begin(), init.end())
 { }
 
@@ -266,10 +592,23 @@ template<typename K, typename V> void vec_map<K, V>::insert(
 
 template<typename K, typename V> void vec_map<K, V>::sort()
 {
+	auto start = std::chrono::steady_clock::now();
 	std::sort(_buckets.begin(), _buckets.end());
+	_sort_time += std::chrono::steady_clock::now() - start;
+
+	++_sort_count;
 	_is_sorted = true;
 }
 
+template<typename K, typename V> void vec_map<K, V>::lazy_sort()
+{
+	if (_is_sorted)
+		return;
+
+	++_lazy_sort_count;
+	sort();
+}
+
 template<typename K, typename V> void vec_map<K, V>::reserve(const size_t max)
 {
 	_buckets.reserve(max);
@@ -283,20 +622,21 @@ template<typename K, typename V> void vec_map<K, V>::shrink_to_fit()
 template<typename K, typename V> void vec_map<K, V>::clear()
 {
 	_buckets.clear();
+	_is_sorted = true;
 }
 
 // value access
 template<typename K, typename V> V& vec_map<K, V>::operator[] (const K& key)
 {
 	// may crash or return wrong value if used with invalid key
-	if (!_is_sorted) sort();
+	lazy_sort();
 	return std::lower_bound(_buckets.begin(), _buckets.end(), key)->value();
 }
 
 template<typename K, typename V> V& vec_map<K, V>::at(const K& key)
 {
 	// should throw properly if used with invalid key
-	if (!_is_sorted) sort();
+	lazy_sort();
 	auto it = std::lower_bound(_buckets.begin(), _buckets.end(), key);
 	if (it != _buckets.end() && it->key() == key)
 		return it->value();
@@ -304,11 +644,21 @@ template<typename K, typename V> V& vec_map<K, V>::at(const K& key)
 		throw std::out_of_range("vec_map key was not valid!");
 }
 
+template<typename K, typename V> auto vec_map<K, V>::find(const K& key) -> bucket_it_t
+{
+	// returns end() if used with invalid key
+	lazy_sort();
+	auto it = std::lower_bound(_buckets.begin(), _buckets.end(), key);
+	if (it != _buckets.end() && it->key() == key)
+		return it;
+	return _buckets.end();
+}
+
 // erase elements
 template<typename K, typename V> void vec_map<K, V>::erase(const K& key)
 {
 	// key erase: container stays sorted
-	if (!_is_sorted) sort();
+	lazy_sort();
 	auto first = std::lower_bound(_buckets.begin(), _buckets.end(), key);
 	if (first != _buckets.end())
 	{
@@ -349,6 +699,533 @@ template<typename K, typename V> void vec_map<K, V>::erase(
 	_buckets.erase(first, last);
 }
 
+// traversal
+template<typename K, typename V> template<typename Func> void vec_map<K, V>::for_each_value(
+	Func func,
+	const size_t prefetch_distance
+)
+{
+	vec_map_util::for_each_bucket(_buckets.begin(), _buckets.end(),
+		[&func](bucket_t& bucket) { func(bucket.value()); },
+		prefetch_distance
+	);
+}
+
+template<typename K, typename V> template<typename Func> void vec_map<K, V>::for_each(
+	Func func,
+	const size_t prefetch_distance
+)
+{
+	vec_map_util::for_each_bucket(_buckets.begin(), _buckets.end(),
+		[&func](bucket_t& bucket) { func(bucket.key(), bucket.value()); },
+		prefetch_distance
+	);
+}
+
+template<typename K, typename V> void vec_map<K, V>::relayout()
+{
+	lazy_sort();
+	vec_map_util::relayout_values(_buckets);
+}
+
+// statistics
+template<typename K, typename V> vec_map_stats vec_map<K, V>::memory_stats() const
+{
+	vec_map_stats stats = {};
+	stats.bucket_bytes = _buckets.capacity() * sizeof(bucket_t);
+	stats.value_heap_bytes = _buckets.size() * vec_map_util::value_heap_size<bucket_t>::value;
+	stats.slack_bytes = (_buckets.capacity() - _buckets.size()) * sizeof(bucket_t);
+	stats.sort_count = _sort_count;
+	stats.lazy_sort_count = _lazy_sort_count;
+	stats.sort_time = _sort_time;
+
+	if (_is_sorted)
+	{
+		for (size_t i = 1; i < _buckets.size(); ++i)
+			stats.duplicate_count += !(_buckets[i - 1] < _buckets[i].key());
+	}
+	else
+	{
+		// counting must not sort the map itself, it would distort the sort statistics
+		std::vector<K> keys;
+		keys.reserve(_buckets.size());
+		for (const auto& bucket : _buckets)
+			keys.push_back(bucket.key());
+
+		std::sort(keys.begin(), keys.end());
+		stats.duplicate_count = static_cast<size_t>(
+			std::distance(std::unique(keys.begin(), keys.end()), keys.end()));
+	}
+
+	return stats;
+}
+
+
+// --- set algebra ---
+
+namespace vec_map_util
+{
+
+template<typename It, typename K> It gallop_lower_bound(
+	const It first,
+	const It last,
+	const K& key
+)
+{
+	// exponential search for the window holding key, then binary search inside it
+	const auto size = std::distance(first, last);
+	decltype(std::distance(first, last)) bound = 1;
+	while (bound < size && first[bound] < key)
+		bound *= 2;
+
+	return std::lower_bound(first + (bound / 2), first + std::min(bound + 1, size), key);
+}
+
+template<typename It, typename K> It advance_to(
+	It first,
+	const It last,
+	const K& key,
+	const bool gallop
+)
+{
+	if (gallop)
+		return gallop_lower_bound(first, last, key);
+
+	while (first != last && *first < key)
+		++first;
+	return first;
+}
+
+inline bool use_gallop(const size_t size, const size_t other_size)
+{
+	return size >= gallop_ratio * (other_size + 1);
+}
+
+// --- join_iterator ---
+
+template<typename K, typename V> join_iterator<K, V>::join_iterator(
+	const bucket_it_t a_first,
+	const bucket_it_t a_last,
+	const bucket_it_t b_first,
+	const bucket_it_t b_last
+) :
+	_a_it(a_first),
+	_a_end(a_last),
+	_b_it(b_first),
+	_b_end(b_last),
+	_gallop_a(use_gallop(std::distance(a_first, a_last), std::distance(b_first, b_last))),
+	_gallop_b(use_gallop(std::distance(b_first, b_last), std::distance(a_first, a_last)))
+{
+	seek();
+}
+
+template<typename K, typename V> join_iterator<K, V>& join_iterator<K, V>::operator++ ()
+{
+	++_a_it;
+	++_b_it;
+	seek();
+	return *this;
+}
+
+template<typename K, typename V> join_iterator<K, V> join_iterator<K, V>::operator++ (int)
+{
+	auto copy = *this;
+	++(*this);
+	return copy;
+}
+
+template<typename K, typename V> void join_iterator<K, V>::seek()
+{
+	// advance both sides until the keys match, an exhausted side ends the join
+	while (_a_it != _a_end && _b_it != _b_end)
+	{
+		if (*_a_it < _b_it->key())
+			_a_it = advance_to(_a_it, _a_end, _b_it->key(), _gallop_a);
+		else if (*_b_it < _a_it->key())
+			_b_it = advance_to(_b_it, _b_end, _a_it->key(), _gallop_b);
+		else
+			return;
+	}
+	_a_it = _a_end;
+}
+
+}
+
+template<typename K, typename V, typename Resolve> vec_map<K, V> merge(
+	vec_map<K, V>& a,
+	vec_map<K, V>& b,
+	Resolve resolve
+)
+{
+	// union of both maps, resolve(a_value, b_value) decides the value of shared keys
+	a.lazy_sort();
+	b.lazy_sort();
+
+	const bool gallop_a = vec_map_util::use_gallop(a.size(), b.size());
+	const bool gallop_b = vec_map_util::use_gallop(b.size(), a.size());
+
+	vec_map<K, V> res;
+	auto& buckets = res.get_internal_vec(); // filled in order, res stays sorted
+	buckets.reserve(a.size() + b.size());
+
+	auto a_it = a.begin();
+	auto b_it = b.begin();
+	while (a_it != a.end() && b_it != b.end())
+	{
+		if (*a_it < b_it->key())
+		{
+			auto next = vec_map_util::advance_to(a_it, a.end(), b_it->key(), gallop_a);
+			std::copy(a_it, next, std::back_inserter(buckets));
+			a_it = next;
+		}
+		else if (*b_it < a_it->key())
+		{
+			auto next = vec_map_util::advance_to(b_it, b.end(), a_it->key(), gallop_b);
+			std::copy(b_it, next, std::back_inserter(buckets));
+			b_it = next;
+		}
+		else
+		{
+			buckets.emplace_back(a_it->key(), resolve(a_it->value(), b_it->value()));
+			++a_it;
+			++b_it;
+		}
+	}
+	std::copy(a_it, a.end(), std::back_inserter(buckets));
+	std::copy(b_it, b.end(), std::back_inserter(buckets));
+
+	return res;
+}
+
+template<typename K, typename V> vec_map<K, V> intersect(
+	vec_map<K, V>& a,
+	vec_map<K, V>& b
+)
+{
+	// shared keys keep the value of a
+	return intersect(a, b, [](const V& a_value, const V&) -> const V& { return a_value; });
+}
+
+template<typename K, typename V, typename Resolve> vec_map<K, V> intersect(
+	vec_map<K, V>& a,
+	vec_map<K, V>& b,
+	Resolve resolve
+)
+{
+	vec_map<K, V> res;
+	auto& buckets = res.get_internal_vec();
+	buckets.reserve(std::min(a.size(), b.size()));
+
+	for (auto buckets_pair : join(a, b))
+		buckets.emplace_back(
+			buckets_pair.first.key(),
+			resolve(buckets_pair.first.value(), buckets_pair.second.value())
+		);
+
+	return res;
+}
+
+template<typename K, typename V> vec_map<K, V> difference(
+	vec_map<K, V>& a,
+	vec_map<K, V>& b
+)
+{
+	// all buckets of a whose key is not present in b
+	a.lazy_sort();
+	b.lazy_sort();
+
+	const bool gallop_a = vec_map_util::use_gallop(a.size(), b.size());
+	const bool gallop_b = vec_map_util::use_gallop(b.size(), a.size());
+
+	vec_map<K, V> res;
+	auto& buckets = res.get_internal_vec();
+	buckets.reserve(a.size());
+
+	auto a_it = a.begin();
+	auto b_it = b.begin();
+	while (a_it != a.end() && b_it != b.end())
+	{
+		if (*a_it < b_it->key())
+		{
+			auto next = vec_map_util::advance_to(a_it, a.end(), b_it->key(), gallop_a);
+			std::copy(a_it, next, std::back_inserter(buckets));
+			a_it = next;
+		}
+		else if (*b_it < a_it->key())
+			b_it = vec_map_util::advance_to(b_it, b.end(), a_it->key(), gallop_b);
+		else
+		{
+			++a_it;
+			++b_it;
+		}
+	}
+	std::copy(a_it, a.end(), std::back_inserter(buckets));
+
+	return res;
+}
+
+template<typename K, typename V> vec_map_util::join_range<K, V> join(
+	vec_map<K, V>& a,
+	vec_map<K, V>& b
+)
+{
+	a.lazy_sort();
+	b.lazy_sort();
+
+	return vec_map_util::join_range<K, V>(
+		vec_map_util::join_iterator<K, V>(a.begin(), a.end(), b.begin(), b.end()),
+		vec_map_util::join_iterator<K, V>(a.end(), a.end(), b.end(), b.end())
+	);
+}
+
+
+// --- hash_vec_map ---
+
+template<typename K, typename V, typename H> hash_vec_map<K, V, H>::hash_vec_map() :
+	_index(min_index_size, { empty_slot, 0 }),
+	_tag_shift(32 - 3)
+{ }
+
+template<typename K, typename V, typename H> hash_vec_map<K, V, H>::hash_vec_map(
+	std::initializer_list<bucket_t> init
+) :
+	hash_vec_map()
+{
+	reserve(init.size());
+	for (const auto& bucket : init)
+		insert(bucket);
+}
+
+template<typename K, typename V, typename H> inline uint32_t hash_vec_map<K, V, H>::tag(
+	const K& key
+) const
+{
+	// fibonacci hashing spreads weak hashes, like the identity hash of integers
+	const uint64_t mixed = static_cast<uint64_t>(_hash(key)) * 11400714819323198485ull;
+	return static_cast<uint32_t>(mixed >> 32);
+}
+
+template<typename K, typename V, typename H> size_t hash_vec_map<K, V, H>::find_position(
+	const K& key,
+	const uint32_t key_tag
+) const
+{
+	for (size_t pos = home(key_tag); _index[pos].slot != empty_slot; pos = (pos + 1) & mask())
+	{
+		if (_index[pos].tag == key_tag && _buckets[_index[pos].slot].key() == key)
+			return pos;
+	}
+	return _index.size();
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::index_insert(
+	const vec_map_util::index_entry entry
+)
+{
+	size_t pos = home(entry.tag);
+	while (_index[pos].slot != empty_slot)
+		pos = (pos + 1) & mask();
+	_index[pos] = entry;
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::index_erase(
+	size_t pos
+)
+{
+	// backward shift deletion, linear probing chains stay intact without tombstones
+	for (size_t next = (pos + 1) & mask(); _index[next].slot != empty_slot; next = (next + 1) & mask())
+	{
+		const size_t next_home = home(_index[next].tag);
+		const bool stays = (pos <= next)
+			? (pos < next_home && next_home <= next)
+			: (pos < next_home || next_home <= next);
+
+		if (!stays)
+		{
+			_index[pos] = _index[next];
+			pos = next;
+		}
+	}
+	_index[pos].slot = empty_slot;
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::rebuild_index(
+	const size_t count
+)
+{
+	// index size is a power of two, kept at most 3/4 full
+	size_t index_size = min_index_size;
+	uint32_t shift = 32 - 3;
+	while (index_size * 3 < count * 4)
+	{
+		index_size *= 2;
+		--shift;
+	}
+
+	auto old_index = std::move(_index);
+	_index.assign(index_size, { empty_slot, 0 });
+	_tag_shift = shift;
+
+	for (const auto entry : old_index)
+		if (entry.slot != empty_slot)
+			index_insert(entry);
+}
+
+// insert
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::insert(
+	const K& key,
+	const V& value
+)
+{
+	const auto key_tag = tag(key);
+	const auto pos = find_position(key, key_tag);
+	if (pos != _index.size())
+	{
+		_buckets[_index[pos].slot] = bucket_t(key, value);
+		return;
+	}
+
+	assert(_buckets.size() < empty_slot && "hash_vec_map index is limited to 32-bit slots");
+
+	if ((_buckets.size() + 1) * 4 > _index.size() * 3)
+		rebuild_index(_buckets.size() + 1);
+
+	index_insert({ static_cast<uint32_t>(_buckets.size()), key_tag });
+	_buckets.emplace_back(key, value);
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::insert(
+	const bucket_t& bucket
+)
+{
+	insert(bucket.key(), bucket.value());
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::insert(
+	const bucket_it_t first,
+	const bucket_it_t last
+)
+{
+	reserve(size() + std::distance(first, last));
+	for (auto it = first; it != last; ++it)
+		insert(it->key(), it->value());
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::reserve(
+	const size_t max
+)
+{
+	_buckets.reserve(max);
+	if (max * 4 > _index.size() * 3)
+		rebuild_index(max);
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::shrink_to_fit()
+{
+	_buckets.shrink_to_fit();
+	rebuild_index(_buckets.size());
+	_index.shrink_to_fit();
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::clear()
+{
+	_buckets.clear();
+	std::fill(_index.begin(), _index.end(), vec_map_util::index_entry{ empty_slot, 0 });
+}
+
+// value access
+template<typename K, typename V, typename H> V& hash_vec_map<K, V, H>::operator[] (
+	const K& key
+)
+{
+	// may crash or return wrong value if used with invalid key
+	const auto pos = find_position(key, tag(key));
+	assert(pos != _index.size() && "hash_vec_map key was not valid!");
+	return _buckets[_index[pos].slot].value();
+}
+
+template<typename K, typename V, typename H> V& hash_vec_map<K, V, H>::at(const K& key)
+{
+	const auto pos = find_position(key, tag(key));
+	if (pos != _index.size())
+		return _buckets[_index[pos].slot].value();
+	else
+		throw std::out_of_range("hash_vec_map key was not valid!");
+}
+
+template<typename K, typename V, typename H> auto hash_vec_map<K, V, H>::find(
+	const K& key
+) -> bucket_it_t
+{
+	const auto pos = find_position(key, tag(key));
+	if (pos != _index.size())
+		return _buckets.begin() + _index[pos].slot;
+	return _buckets.end();
+}
+
+// traversal
+template<typename K, typename V, typename H> template<typename Func>
+void hash_vec_map<K, V, H>::for_each_value(
+	Func func,
+	const size_t prefetch_distance
+)
+{
+	vec_map_util::for_each_bucket(_buckets.begin(), _buckets.end(),
+		[&func](bucket_t& bucket) { func(bucket.value()); },
+		prefetch_distance
+	);
+}
+
+template<typename K, typename V, typename H> template<typename Func>
+void hash_vec_map<K, V, H>::for_each(
+	Func func,
+	const size_t prefetch_distance
+)
+{
+	vec_map_util::for_each_bucket(_buckets.begin(), _buckets.end(),
+		[&func](bucket_t& bucket) { func(bucket.key(), bucket.value()); },
+		prefetch_distance
+	);
+}
+
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::relayout()
+{
+	vec_map_util::relayout_values(_buckets);
+}
+
+// statistics
+template<typename K, typename V, typename H> vec_map_stats hash_vec_map<K, V, H>::memory_stats() const
+{
+	// keys are unique and the index replaces sorting
+	vec_map_stats stats = {};
+	stats.bucket_bytes = _buckets.capacity() * sizeof(bucket_t);
+	stats.value_heap_bytes = _buckets.size() * vec_map_util::value_heap_size<bucket_t>::value;
+	stats.index_bytes = _index.capacity() * sizeof(vec_map_util::index_entry);
+	stats.slack_bytes = (_buckets.capacity() - _buckets.size()) * sizeof(bucket_t);
+	return stats;
+}
+
+// erase element
+template<typename K, typename V, typename H> void hash_vec_map<K, V, H>::erase(const K& key)
+{
+	const auto pos = find_position(key, tag(key));
+	if (pos == _index.size())
+		return;
+
+	const auto slot = _index[pos].slot;
+	index_erase(pos);
+
+	const auto last_slot = static_cast<uint32_t>(_buckets.size() - 1);
+	if (slot != last_slot)
+	{
+		// move the last bucket into the gap and point its index entry there
+		const auto last_pos = find_position(_buckets.back().key(), tag(_buckets.back().key()));
+		_index[last_pos].slot = slot;
+		_buckets[slot] = std::move(_buckets.back());
+	}
+	_buckets.pop_back();
+}
+
 }
 
 #endif // VOOL_VECMAP_H_INCLUDED
\ No newline at end of file
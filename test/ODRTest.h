@@ -14,5 +14,6 @@
 #include <GNP.h>
 #include <TestSuit.h>
 #include <TaskQueue.h>
+#include <TaskCoroutine.h>
 
 #endif // VOOL_TESTS_ODRTEST_H_INCLUDED
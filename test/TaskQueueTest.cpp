@@ -9,10 +9,16 @@
 #include "AllTests.h"
 
 #include <TaskQueue.h>
+#include <TaskCoroutine.h>
 
 #include <vector>
 #include <string>
 #include <random>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <functional>
 #include <exception>
 
 namespace vool
@@ -21,6 +27,65 @@ namespace vool
 namespace tests
 {
 
+#if defined(VOOL_TASK_COROUTINES)
+task<int> square(const int value)
+{
+	co_return value * value;
+}
+
+task<int> sum_after(task_queue& tq, const async_t::prereq prerequisite, const int& first)
+{
+	co_await prerequisite; // suspends, a blocking wait would take the only worker
+	auto second = tq.add_task([]() { return 2; });
+	const int child = co_await square(3);
+	co_return first + co_await second + child;
+}
+
+task<> failing_child()
+{
+	throw std::runtime_error("bad coroutine");
+	co_return;
+}
+
+task<int> failing_value()
+{
+	co_await failing_child();
+	co_return 1;
+}
+
+task<int> catching(task_queue& tq)
+{
+	int caught = 0;
+	try { co_await failing_child(); }
+	catch (std::runtime_error&) { ++caught; }
+
+	// the future keeps the record, so the prereq still reports the failure
+	auto failed = tq.add_task([]() -> int { throw std::runtime_error("bad task"); });
+	const async_t::prereq failed_handle = failed;
+	try { co_await failed_handle; }
+	catch (std::runtime_error&) { ++caught; }
+
+	// fails before or after this coroutine suspended on it, its record may be reused by then
+	auto unheld = tq.add_task([]() { throw std::runtime_error("bad task"); });
+	try { co_await unheld; }
+	catch (std::runtime_error&) { ++caught; }
+
+	// certainly finished and reused before the co_await
+	auto finished = tq.add_task([]() { throw std::runtime_error("bad task"); });
+	const auto cancelled = tq.add_task([]() {}, { finished });
+	try { co_await cancelled; }
+	catch (std::runtime_error&) { ++caught; }
+	for (int i = 0; i < 100; ++i)
+	{
+		const auto other = tq.add_task([]() {});
+		co_await other;
+	}
+	try { co_await finished; }
+	catch (std::runtime_error&) { ++caught; }
+	co_return caught;
+}
+#endif
+
 void test_TaskQueue()
 {
 	size_t testSize = static_cast<size_t>(1e4);
@@ -345,6 +410,870 @@ void test_TaskQueue()
 			heavyTest(i * 1445);
 	}
 
+	// #9 fixed worker pool
+	{
+		task_queue_config config;
+		config.worker_count = 2;
+
+		task_queue tq(config);
+		if (tq.worker_count() != 2)
+			throw std::exception("task_queue did not start the configured workers");
+
+		size_t taskCount = 1000;
+		std::atomic<size_t> counter(0);
+		for (size_t i = 0; i < taskCount; ++i)
+			tq.add_task([&counter]() { ++counter; });
+
+		tq.wait_all();
+		if (counter != taskCount)
+			throw std::exception("worker pool missed a task");
+	}
+
+	// #10 work stealing deque
+	{
+		task_queue_util::work_stealing_deque<size_t> deque(2); // forces growth
+		std::vector<size_t> items(testSize);
+
+		for (auto& item : items)
+			deque.push(&item);
+
+		// owner takes the newest, thieves the oldest item
+		if (deque.pop() != &items.back() || deque.steal() != &items.front())
+			throw std::exception("work_stealing_deque order error");
+		++items.back();
+		++items.front();
+
+		// owner and thieves race for the rest, every item has to be taken exactly once
+		std::atomic<size_t> taken(2);
+		std::vector<std::thread> thieves;
+		for (size_t i = 0; i < 3; ++i)
+			thieves.emplace_back([&deque, &taken]()
+			{
+				while (!deque.empty())
+					if (auto item = deque.steal())
+						++*item, ++taken;
+			});
+
+		while (auto item = deque.pop())
+			++*item, ++taken;
+
+		for (auto& thief : thieves)
+			thief.join();
+
+		if (taken != testSize || deque.pop() != nullptr
+			|| std::count(items.begin(), items.end(), size_t(1)) != static_cast<std::ptrdiff_t>(testSize))
+			throw std::exception("work_stealing_deque lost or duplicated an item");
+	}
+
+	// #11 dependency chain
+	{
+		size_t chainLength = 1000;
+		std::vector<size_t> order;
+		order.reserve(chainLength);
+
+		task_queue tq;
+
+		// every link depends on the previous one and on a shared fan out task
+		auto fanOut = tq.add_task([]() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+		auto link = tq.add_task([&order]() { order.push_back(0); });
+		for (size_t i = 1; i < chainLength; ++i)
+			link = tq.add_task([&order, i]() { order.push_back(i); }, { link, fanOut });
+
+		tq.wait(link);
+
+		if (order.size() != chainLength || !std::is_sorted(order.begin(), order.end()))
+			throw std::exception("dependent task started before its prerequisite finished");
+	}
+
+	// #12 parked workers and waiters
+	{
+		task_queue tq;
+
+		// let all workers run out of work and park
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		std::atomic<int> done(0);
+		auto slowTask = tq.add_task([&done]()
+		{ std::this_thread::sleep_for(std::chrono::milliseconds(50)); ++done; });
+
+		// several threads park on the same task
+		std::vector<std::thread> waiters;
+		for (size_t i = 0; i < 3; ++i)
+			waiters.emplace_back([&tq, &done, slowTask]()
+			{
+				tq.wait(slowTask);
+				if (done != 1)
+					done = -100;
+			});
+
+		for (auto& waiter : waiters)
+			waiter.join();
+
+		if (done != 1)
+			throw std::exception("parked waiter returned before its task finished");
+	}
+
+	// #13 lock policies
+	{
+		auto lockTest([testSize](auto& lock)
+		{
+			size_t counter = 0;
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < 4; ++i)
+				threads.emplace_back([&lock, &counter, testSize]()
+				{
+					for (size_t b = 0; b < testSize; ++b)
+					{
+						std::lock_guard<std::remove_reference_t<decltype(lock)>> guard(lock);
+						++counter;
+					}
+				});
+
+			for (auto& thread : threads)
+				thread.join();
+
+			if (counter != testSize * 4)
+				throw std::exception("lock policy did not provide mutual exclusion");
+
+			if (!lock.try_lock() || lock.try_lock())
+				throw std::exception("lock policy try_lock error");
+			lock.unlock();
+		});
+
+		task_queue_util::spin_lock<task_queue_util::yield_backoff> yieldLock;
+		task_queue_util::spin_lock<task_queue_util::exponential_backoff> backoffLock;
+		task_queue_util::ticket_lock ticketLock;
+
+		lockTest(yieldLock);
+		lockTest(backoffLock);
+		lockTest(ticketLock);
+	}
+
+	// #14 concurrent submission
+	{
+		size_t producerCount = 8;
+		size_t tasksPerProducer = 500;
+
+		task_queue tq;
+
+		std::atomic<size_t> counter(0);
+		auto root = tq.add_task([]() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+		bool orderError = false;
+
+		// no external synchronisation, every chain also depends on a task of another thread
+		std::vector<std::thread> producers;
+		for (size_t i = 0; i < producerCount; ++i)
+			producers.emplace_back([&tq, &counter, &orderError, root, tasksPerProducer]()
+			{
+				size_t last = 0;
+				auto link = root;
+				for (size_t b = 0; b < tasksPerProducer; ++b)
+					link = tq.add_task([&counter, &orderError, &last, b]()
+					{
+						orderError = orderError || last != b;
+						last = b + 1;
+						++counter;
+					}, { link, root });
+
+				tq.wait(link);
+			});
+
+		for (auto& producer : producers)
+			producer.join();
+
+		tq.wait_all();
+		if (counter != producerCount * tasksPerProducer || orderError)
+			throw std::exception("concurrently submitted tasks were lost or reordered");
+	}
+
+	// #15 reused task records
+	{
+		task_queue tq;
+
+		auto first = tq.add_task([]() {});
+		tq.wait(first);
+
+		// finished records are reused, the old prereq has to stay recognisably finished
+		for (size_t i = 0; i < testSize; ++i)
+			tq.wait(tq.add_task([]() {}));
+
+		if (tq.task_capacity() > testSize / 2)
+			throw std::exception("finished task records were not reused");
+
+		bool ran = false;
+		tq.wait(first); // this should not block
+		tq.wait(tq.add_task([&ran]() { ran = true; }, { first }));
+		if (!ran)
+			throw std::exception("stale prereq blocked a task");
+	}
+
+	// #16 inline task callables
+	{
+		struct counted
+		{
+			std::atomic<int>& alive;
+			explicit counted(std::atomic<int>& a) : alive(a) { ++alive; }
+			counted(const counted& other) : alive(other.alive) { ++alive; }
+			~counted() { --alive; }
+		};
+
+		std::atomic<int> alive(0);
+		size_t sum = 0;
+		{
+			task_queue tq;
+
+			// move only capture, stored inline
+			auto owned = std::make_unique<size_t>(5);
+			auto condA = tq.add_task([owned = std::move(owned), &sum, c = counted(alive)]() { sum += *owned; });
+
+			// too big for the inline buffer, stored on the heap
+			std::array<size_t, 32> big = {};
+			big.back() = 7;
+			tq.add_task([big, &sum, c = counted(alive)]() { sum += big.back(); }, { condA });
+		}
+
+		if (sum != 12 || alive != 0)
+			throw std::exception("task_function lost a callable or leaked its captures");
+
+		task_queue_util::task_function func([&sum]() { ++sum; });
+		auto moved = std::move(func);
+		moved();
+		if (func || !moved || sum != 13)
+			throw std::exception("task_function move error");
+	}
+
+	// #17 task futures
+	{
+		task_queue tq;
+
+		auto number = tq.add_task([]() { return size_t(20); });
+		auto text = tq.add_task([]() { return std::string(40, 'x'); }); // stored on the heap
+		auto sum = tq.add_task([&number]() { return number.get() + 1; }, { number });
+
+		// a future is usable as prerequisite of plain tasks too
+		size_t length = 0;
+		auto condA = tq.add_task([&text, &length]() { length = text.get().size(); }, { text });
+
+		tq.wait(condA);
+		if (sum.get() != 21 || length != 40 || number.valid() || text.valid() || sum.valid())
+			throw std::exception("task_future result error");
+
+		// unclaimed results are destroyed together with their record
+		std::atomic<int> alive(0);
+		struct counted
+		{
+			std::atomic<int>* alive;
+			explicit counted(std::atomic<int>& a) : alive(&a) { ++*alive; }
+			counted(const counted& other) : alive(other.alive) { ++*alive; }
+			~counted() { --*alive; }
+		};
+		{
+			auto unclaimed = tq.add_task([&alive]() { return counted(alive); });
+			unclaimed.wait();
+			if (!unclaimed.ready() || alive != 1)
+				throw std::exception("task_future should keep the result alive");
+		}
+		tq.wait_all();
+		if (alive != 0)
+			throw std::exception("task_future leaked a result");
+
+		bool thrown = false;
+		try { sum.get(); }
+		catch (std::logic_error&) { thrown = true; }
+		if (!thrown)
+			throw std::exception("task_future get should fail once the result is taken");
+	}
+
+	// #18 exceptions in tasks
+	{
+		for (const auto policy : { task_failure_policy::cancel_dependents, task_failure_policy::run_dependents })
+		{
+			task_queue_config config;
+			config.failure_policy = policy;
+			config.worker_count = 4;
+			task_queue tq(config);
+
+			// keeps the failing task from finishing before its dependents are linked
+			std::atomic<bool> open(false);
+			auto gate = tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+			std::atomic<size_t> runs(0);
+			auto failing = tq.add_task([]() { throw std::runtime_error("bad input"); }, { gate });
+			auto dependent = tq.add_task([&runs]() { ++runs; }, { failing });
+			auto result = tq.add_task([&runs]() { ++runs; return size_t(3); }, { dependent });
+			auto independent = tq.add_task([&runs]() { ++runs; });
+			open = true;
+
+			size_t caught = 0;
+			try { tq.wait(failing); }
+			catch (std::runtime_error&) { ++caught; }
+
+			tq.wait(independent); // the worker survived the exception
+
+			try { tq.wait(dependent); }
+			catch (std::runtime_error&) { ++caught; }
+
+			try { caught += result.get(); }
+			catch (std::runtime_error&) { ++caught; }
+
+			try { tq.wait_all(); }
+			catch (std::runtime_error&) { ++caught; }
+
+			tq.wait_all(); // reported once
+
+			const bool cancelled = policy == task_failure_policy::cancel_dependents;
+			if (runs != (cancelled ? 1 : 3) || caught != (cancelled ? 4 : 5))
+				throw std::exception("task exception propagation error");
+		}
+
+		// failures reported without wait_all do not hold on to their records
+		task_queue_config config;
+		config.worker_count = 4;
+		task_queue tq(config);
+
+		size_t caught = 0;
+		for (size_t i = 0; i < testSize; ++i)
+		{
+			auto failing = tq.add_task([]() -> int { throw std::runtime_error("bad input"); });
+			try { failing.get(); }
+			catch (std::runtime_error&) { ++caught; }
+		}
+
+		// a failed task stays reportable by its prereq after it finished and its record was reused
+		std::atomic<size_t> runs(0);
+		auto failing = tq.add_task([]() { throw std::runtime_error("bad input"); });
+		try { tq.wait(tq.add_task([&runs]() { ++runs; }, { failing })); }
+		catch (std::runtime_error&) { ++caught; }
+		for (size_t i = 0; i < 100; ++i)
+			tq.wait(tq.add_task([]() {}));
+
+		auto late = tq.add_task([&runs]() { ++runs; }, { failing });
+		try { tq.wait(late); }
+		catch (std::runtime_error&) { ++caught; }
+		try { tq.wait(failing); }
+		catch (std::runtime_error&) { ++caught; }
+		tq.wait(failing); // reported once
+
+		try { tq.wait_all(); }
+		catch (std::runtime_error&) { ++caught; }
+		if (caught != testSize + 4 || runs != 0 || tq.task_capacity() >= testSize)
+			throw std::exception("task exception report error");
+	}
+
+	// #19 parallel loops
+	{
+		task_queue tq;
+
+		const size_t count = 100000;
+		std::vector<int> visits(count, 0);
+		tq.parallel_for(0, count, 64, [&visits](const size_t i) { ++visits[i]; });
+		if (std::count(visits.begin(), visits.end(), 1) != static_cast<std::ptrdiff_t>(count))
+			throw std::exception("parallel_for should visit every index once");
+
+		const auto sum = tq.parallel_reduce(size_t(0), count, 100, size_t(0),
+			[](const size_t i) { return i; },
+			[](const size_t a, const size_t b) { return a + b; });
+		if (sum != count * (count - 1) / 2)
+			throw std::exception("parallel_reduce sum error");
+
+		// not commutative, the order of the operands has to be kept
+		const auto digits = tq.parallel_reduce(size_t(0), size_t(20), 1, std::string(),
+			[](const size_t i) { return std::to_string(i % 10); },
+			[](const std::string& a, const std::string& b) { return a + b; });
+		if (digits != "01234567890123456789")
+			throw std::exception("parallel_reduce order error");
+
+		// nested inside a task, a single worker has to get through it on its own
+		task_queue_config config;
+		config.worker_count = 1;
+		task_queue single(config);
+
+		std::atomic<size_t> nested(0);
+		single.wait(single.add_task([&single, &nested]()
+		{
+			single.parallel_for(0, 1000, 10, [&nested](const size_t) { ++nested; });
+		}));
+		if (nested != 1000)
+			throw std::exception("nested parallel_for error");
+
+		bool thrown = false;
+		try
+		{
+			tq.parallel_for(0, count, 64, [](const size_t i)
+			{
+				if (i == 4242)
+					throw std::runtime_error("bad index");
+			});
+		}
+		catch (std::runtime_error&) { thrown = true; }
+		tq.wait_all(); // the failed piece did not fail as a task
+
+		if (!thrown)
+			throw std::exception("parallel_for should rethrow");
+	}
+
+	// #20 priorities and deadlines
+	{
+		task_queue_config config;
+		config.worker_count = 1;
+		config.aging_interval = 0;
+
+		std::mutex order_sync;
+		std::string order;
+		auto mark = [&order_sync, &order](const char c)
+		{
+			return [&order_sync, &order, c]()
+			{
+				std::lock_guard<std::mutex> lock(order_sync);
+				order.push_back(c);
+			};
+		};
+
+		{
+			task_queue tq(config);
+
+			// everything becomes ready while the only worker is busy
+			std::atomic<bool> open(false);
+			tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+			const auto now = task_config::clock_t::now();
+			task_config later;
+			later.deadline = now + std::chrono::seconds(2);
+			task_config sooner;
+			sooner.deadline = now + std::chrono::seconds(1);
+
+			tq.add_task(mark('l'), {}, task_config(task_priority::low));
+			tq.add_task(mark('n'));
+			tq.add_task(mark('h'), {}, task_config(task_priority::high));
+			tq.add_task(mark('2'), {}, later);
+			tq.add_task(mark('1'), {}, sooner);
+			auto value = tq.add_task([]() { return 7; }, {}, task_config(task_priority::high));
+			open = true;
+
+			if (value.get() != 7)
+				throw std::exception("prioritized task_future error");
+		}
+		if (order != "12hnl")
+			throw std::exception("tasks should run by deadline and priority");
+
+		// aging lets the low priority task pass a steady stream of high priority ones
+		config.aging_interval = 2;
+		order.clear();
+		{
+			task_queue tq(config);
+
+			std::atomic<bool> open(false);
+			tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+			tq.add_task(mark('l'), {}, task_config(task_priority::low));
+			for (size_t i = 0; i < 100; ++i)
+				tq.add_task(mark('h'), {}, task_config(task_priority::high));
+			open = true;
+		}
+		if (order.find('l') > 10)
+			throw std::exception("aging should prevent starvation");
+	}
+
+	// #21 critical path ranking
+	{
+		task_queue_config config;
+		config.worker_count = 1;
+
+		std::mutex order_sync;
+		std::string order;
+		auto mark = [&order_sync, &order](const char c)
+		{
+			return [&order_sync, &order, c]()
+			{
+				std::lock_guard<std::mutex> lock(order_sync);
+				order.push_back(c);
+			};
+		};
+
+		{
+			task_queue tq(config);
+
+			std::atomic<bool> open(false);
+			tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+			{
+				critical_path_scope scope(tq);
+
+				// a wide fan-out first, then a long chain, the chain is the critical path
+				std::vector<async_t::prereq> fan;
+				for (char c = 'a'; c < 'e'; ++c)
+					fan.push_back(tq.add_task(mark(c)));
+				tq.add_task(mark('e'), fan);
+
+				auto chain = tq.add_task(mark('1'));
+				for (char c = '2'; c < '6'; ++c)
+					chain = tq.add_task(mark(c), { chain });
+
+				// an expensive task ranks above a cheap chain of the same length
+				task_config expensive;
+				expensive.cost = 10;
+				tq.add_task(mark('x'), {}, expensive);
+			}
+			open = true;
+		}
+
+		// ranks: x 10, chain 5 4 3 2 1, fan 2 and its sink 1
+		if (order.size() != 11 || order.substr(0, 4) != "x123")
+			throw std::exception("critical path ranking error");
+	}
+
+	// #22 reusable task graph
+	{
+		task_queue_config config;
+		config.worker_count = 4;
+		task_queue tq(config);
+
+		// diamond, every node checks its prerequisites ran in the same run
+		std::array<std::atomic<size_t>, 4> runs = {};
+		bool ordered = true;
+		task_graph graph;
+		auto top = graph.add_node([&runs]() { ++runs[0]; });
+		auto left = graph.add_node([&runs, &ordered]() { ordered &= runs[0] == runs[1] + 1; ++runs[1]; });
+		auto right = graph.add_node([&runs]() { ++runs[2]; });
+		auto bottom = graph.add_node([&runs, &ordered]()
+		{
+			ordered &= runs[1] == runs[3] + 1 && runs[2] == runs[3] + 1;
+			++runs[3];
+		});
+		graph.add_edge(top, left);
+		graph.add_edge(top, right);
+		graph.add_edge(left, bottom);
+		graph.add_edge(right, bottom);
+
+		if (!graph.validate())
+			throw std::exception("task_graph validate error");
+
+		const size_t repetitions = 1000;
+		for (size_t i = 0; i < repetitions; ++i)
+			graph.run(tq);
+
+		for (const auto& count : runs)
+			if (count != repetitions)
+				throw std::exception("task_graph run count error");
+		if (!ordered)
+			throw std::exception("task_graph order error");
+
+		// the graph brings its own records, the runs take none of the queue
+		if (tq.task_capacity() != 0)
+			throw std::exception("task_graph record error");
+
+		// a node added after runs is part of the next one
+		graph.add_edge(bottom, graph.add_node([&runs]() { ++runs[0]; }));
+		graph.run(tq);
+		if (runs[0] != repetitions + 2 || runs[3] != repetitions + 1)
+			throw std::exception("task_graph rebuild error");
+
+		// a node that throws skips the rest of the run, the graph stays usable
+		bool fail = true;
+		task_graph failing;
+		auto first = failing.add_node([&fail]() { if (fail) throw std::runtime_error("bad node"); });
+		size_t after = 0;
+		failing.add_edge(first, failing.add_node([&after]() { ++after; }));
+
+		bool thrown = false;
+		try { failing.run(tq); }
+		catch (std::runtime_error&) { thrown = true; }
+		fail = false;
+		failing.run(tq);
+		if (!thrown || after != 1)
+			throw std::exception("task_graph exception error");
+
+		// cycles are rejected
+		failing.add_edge(1, 0);
+		thrown = false;
+		try { failing.run(tq); }
+		catch (std::logic_error&) { thrown = true; }
+		if (failing.validate() || !thrown)
+			throw std::exception("task_graph cycle error");
+	}
+
+	// #23 continuations
+	{
+		// a blocked task may not hold up the others
+		task_queue_config config;
+		config.worker_count = 2;
+		task_queue tq(config);
+
+		// keeps the first task from finishing before its continuation is linked
+		std::atomic<bool> open(false);
+		std::thread::id first_thread;
+		std::thread::id then_thread;
+		auto first = tq.add_task([&open, &first_thread]()
+		{
+			while (!open) std::this_thread::yield();
+			first_thread = std::this_thread::get_id();
+		});
+		auto next = tq.then(first, [&then_thread]() { then_thread = std::this_thread::get_id(); });
+		auto value = tq.then(next, []() { return 21; });
+		auto doubled = tq.then(value, [&value]() { return value.get() * 2; });
+		open = true;
+
+		if (doubled.get() != 42 || first_thread != then_thread)
+			throw std::exception("then should run on the finishing worker");
+
+		std::atomic<size_t> runs(0);
+		auto a = tq.add_task([&runs]() { ++runs; });
+		auto b = tq.add_task([&runs]() { ++runs; });
+		auto c = tq.add_task([&runs]() { ++runs; return 1; });
+		tq.wait(tq.when_all(a, b, c));
+		if (runs != 3)
+			throw std::exception("when_all error");
+
+		// satisfied by the fast task while the slow one is still blocked
+		open = false;
+		auto slow = tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+		auto fast = tq.add_task([]() {});
+		std::atomic<bool> any_ran(false);
+		tq.wait(tq.then(tq.when_any(slow, fast), [&any_ran]() { any_ran = true; }));
+		open = true;
+		tq.wait_all();
+		if (!any_ran)
+			throw std::exception("when_any error");
+
+		// finished prerequisites and none at all satisfy it right away
+		tq.wait(tq.when_any(a, slow));
+		tq.wait(tq.when_any(std::vector<async_t::prereq>()));
+		tq.wait(tq.when_all());
+	}
+
+	// #24 nested waits
+	{
+		// a single worker has to run the children of the task it is waiting in
+		task_queue_config config;
+		config.worker_count = 1;
+		task_queue tq(config);
+
+		std::function<size_t(size_t)> fib = [&tq, &fib](const size_t n) -> size_t
+		{
+			if (n < 2)
+				return n;
+
+			auto left = tq.add_task([&fib, n]() { return fib(n - 1); });
+			const size_t right = fib(n - 2);
+			return left.get() + right;
+		};
+		if (tq.add_task([&fib]() { return fib(16); }).get() != 987)
+			throw std::exception("nested wait error");
+
+		task_graph graph;
+		size_t runs = 0;
+		graph.add_edge(graph.add_node([&runs]() { ++runs; }), graph.add_node([&runs]() { ++runs; }));
+		tq.wait(tq.add_task([&graph, &tq]() { graph.run(tq); }));
+		if (runs != 2)
+			throw std::exception("task_graph run inside a task error");
+
+		bool thrown = false;
+		tq.wait(tq.add_task([&tq, &thrown]()
+		{
+			try { tq.wait_all(); }
+			catch (std::logic_error&) { thrown = true; }
+		}));
+		if (!thrown)
+			throw std::exception("wait_all inside a task should throw");
+	}
+
+	// #25 numa placement
+	{
+		task_queue_config config;
+		config.worker_count = 4;
+		config.pin_workers = true;
+		task_queue tq(config);
+
+		if (tq.node_count() == 0 || tq.node_count() > tq.worker_count())
+			throw std::exception("node_count error");
+		for (size_t worker = 0; worker < tq.worker_count(); ++worker)
+			if (tq.worker_node(worker) >= tq.node_count())
+				throw std::exception("worker_node error");
+
+		// hints for every node, and none, run like any other task
+		std::atomic<size_t> runs(0);
+		for (size_t node = 0; node <= tq.node_count(); ++node)
+		{
+			task_config placed;
+			placed.node = node < tq.node_count() ? node : size_t(task_config::any_node);
+			for (size_t i = 0; i < 100; ++i)
+				tq.add_task([&runs]() { ++runs; }, {}, placed);
+		}
+		tq.wait_all();
+		if (runs != (tq.node_count() + 1) * 100)
+			throw std::exception("node hint error");
+
+		// a node the queue does not have is rejected, also one that does not fit a byte
+		size_t rejected = 0;
+		for (const size_t node : { tq.node_count(), size_t(256), size_t(task_config::any_node) + tq.node_count() + 1 })
+		{
+			task_config placed;
+			placed.node = node;
+			try { tq.add_task([&runs]() { ++runs; }, {}, placed); }
+			catch (std::invalid_argument&) { ++rejected; }
+			try { tq.add_task([]() { return 0; }, {}, placed); }
+			catch (std::invalid_argument&) { ++rejected; }
+			try { tq.add_tasks(std::vector<std::function<void()>>(2, [&runs]() { ++runs; }), {}, placed); }
+			catch (std::invalid_argument&) { ++rejected; }
+		}
+		tq.wait_all();
+		if (rejected != 9 || runs != (tq.node_count() + 1) * 100)
+			throw std::exception("node hint check error");
+	}
+
+	// #26 batch submission
+	{
+		task_queue tq;
+
+		std::atomic<bool> open(false);
+		auto gate = tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+		std::atomic<size_t> runs(0);
+		std::atomic<size_t> early(0);
+		std::vector<std::function<void()>> callables(testSize, [&runs, &open, &early]()
+		{
+			early += open ? 0 : 1;
+			++runs;
+		});
+		auto batch = tq.add_tasks(callables, { gate });
+		if (batch.tasks.size() != testSize)
+			throw std::exception("add_tasks handle count error");
+
+		open = true;
+		tq.wait(batch.group);
+		if (runs != testSize || early != 0)
+			throw std::exception("add_tasks group error");
+		for (const auto& task : batch.tasks)
+			tq.wait(task);
+
+		// moved out of an rvalue range, move-only captures work
+		std::atomic<size_t> sum(0);
+		auto make = [&sum](const size_t i)
+		{
+			return [value = std::make_unique<size_t>(i), &sum]() { sum += *value; };
+		};
+		std::vector<decltype(make(0))> moved;
+		for (size_t i = 0; i < 10; ++i)
+			moved.push_back(make(i));
+		tq.wait(tq.add_tasks(std::move(moved)).group);
+		if (sum != 45)
+			throw std::exception("add_tasks move error");
+
+		// an empty batch is finished right away, a failed task fails the group
+		tq.wait(tq.add_tasks(std::vector<std::function<void()>>()).group);
+
+		std::vector<std::function<void()>> failing(3, []() {});
+		failing[1] = []() { throw std::runtime_error("bad batch task"); };
+		open = false;
+		auto closed = tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+		auto report = tq.add_task([]() { return 0; }, { tq.add_tasks(failing, { closed }).group });
+		open = true;
+		bool thrown = false;
+		try { report.get(); }
+		catch (std::runtime_error&) { thrown = true; }
+		try { tq.wait_all(); }
+		catch (std::runtime_error&) {}
+		if (!thrown)
+			throw std::exception("add_tasks failure error");
+	}
+
+	// #27 cancellation tokens
+	{
+		task_queue_config config;
+		config.failure_policy = task_failure_policy::run_dependents;
+		task_queue tq(config);
+
+		std::atomic<bool> open(false);
+		auto gate = tq.add_task([&open]() { while (!open) std::this_thread::yield(); });
+
+		task_config cancellable;
+		cancellable.token = make_cancellation_token();
+
+		// nothing of it starts before the token is cancelled
+		std::atomic<size_t> runs(0);
+		auto skipped = tq.add_task([&runs]() { ++runs; }, { gate }, cancellable);
+		auto value = tq.add_task([&runs]() { ++runs; return 1; }, { gate }, cancellable);
+		auto batch = tq.add_tasks(std::vector<std::function<void()>>(10, [&runs]() { ++runs; }), { gate }, cancellable);
+		auto dependent = tq.add_task([&runs]() { ++runs; return 0; }, { skipped }); // cancelled despite run_dependents
+		auto batch_dependent = tq.add_task([]() { return 0; }, { batch.group });
+		cancellable.token.cancel();
+		open = true;
+
+		size_t caught = 0;
+		try { value.get(); }
+		catch (task_cancelled&) { ++caught; }
+		try { tq.wait(dependent); }
+		catch (task_cancelled&) { ++caught; }
+		try { batch_dependent.get(); }
+		catch (task_cancelled&) { ++caught; }
+		try { dependent.get(); }
+		catch (task_cancelled&) { ++caught; }
+
+		// dependents added after the cancelled task finished are cancelled too,
+		// its future keeps the record and so the cancellation
+		auto finished = tq.add_task([&runs]() { ++runs; return 1; }, {}, cancellable);
+		while (!finished.ready())
+			std::this_thread::yield();
+		auto late = tq.add_task([&runs]() { ++runs; return 0; }, { finished });
+		tq.add_tasks(std::vector<std::function<void()>>(4, [&runs]() { ++runs; }), { finished });
+		try { late.get(); }
+		catch (task_cancelled&) { ++caught; }
+
+		tq.wait_all(); // cancelled tasks are no error
+		if (runs != 0 || caught != 5)
+			throw std::exception("cancellation skip error");
+
+		// a running task polls its token and gives up
+		task_config polled;
+		polled.token = make_cancellation_token();
+		std::atomic<bool> started(false);
+		auto token = polled.token;
+		auto running = tq.add_task([&started, token]() -> int
+		{
+			started = true;
+			while (true)
+			{
+				token.throw_if_cancelled();
+				std::this_thread::yield();
+			}
+		}, {}, polled);
+		while (!started)
+			std::this_thread::yield();
+		polled.token.cancel();
+
+		bool thrown = false;
+		try { running.get(); }
+		catch (task_cancelled&) { thrown = true; }
+		if (!thrown || !token.cancelled() || cancellation_token().cancelled())
+			throw std::exception("cancellation poll error");
+	}
+
+#if defined(VOOL_TASK_COROUTINES)
+	// #28 coroutines
+	{
+		task_queue_config config;
+		config.worker_count = 4;
+		task_queue tq(config);
+
+		int first = 0;
+		auto late = tq.add_task([&first]() { first = 31; });
+		auto sum = spawn(tq, sum_after(tq, late, first));
+		if (sum.get() != 42)
+			throw std::exception("coroutine await error");
+
+		if (spawn(tq, catching(tq)).get() != 5)
+			throw std::exception("coroutine exception error");
+
+		bool thrown = false;
+		try { spawn(tq, failing_value()).get(); }
+		catch (std::runtime_error&) { thrown = true; }
+		try { tq.wait_all(); }
+		catch (std::runtime_error&) {}
+		if (!thrown)
+			throw std::exception("spawned coroutine should fail its task");
+	}
+#endif
+
 }
 
 }
@@ -13,6 +13,7 @@
 #include <vector>
 #include <string>
 #include <unordered_set>
+#include <sstream>
 #include <exception>
 
 namespace vool
@@ -98,6 +99,25 @@ void test_TestSuit()
 		suitB.perform_categorys(0, size);
 		suitB.render_results();
 
+		std::ostringstream csv;
+		suitB.write_results(csv);
+		if (csv.str().find("container_build,build vec and sort,") == std::string::npos)
+			throw std::exception("write_results() missing rows");
+
+		// setup runs untimed before every repetition
+		size_t setupCalls = 0;
+		auto setupTest = make_test("setup",
+			[&setupCalls](const size_t)
+			{
+				if (setupCalls == 0)
+					throw std::exception("setup was not called before test");
+			},
+			[&setupCalls](const size_t) { ++setupCalls; }
+		);
+		setupTest.run_test(size, repetitions);
+		if (setupCalls != repetitions)
+			throw std::exception("setup not called once per repetition");
+
 		// test empty category
 		auto invisibleTest = testB;
 		invisibleTest.flag_invisible();
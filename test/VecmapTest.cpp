@@ -163,6 +163,134 @@ void test_Vecmap()
 			throw std::exception("clear error");
 	}
 
+	// set algebra
+	{
+		vool::vec_map<K, K> mapA({ { 4, 40 },{ 1, 10 },{ 3, 30 },{ 7, 70 } });
+		vool::vec_map<K, K> mapB({ { 3, 3 },{ 5, 5 },{ 7, 7 },{ 0, 0 } });
+
+		auto merged = merge(mapA, mapB, [](const K a, const K b) { return a + b; });
+		if (merged.size() != 6 || !merged.is_sorted())
+			throw std::exception("merge size error");
+		if (merged.at(3) != 33 || merged.at(0) != 0 || merged.at(4) != 40)
+			throw std::exception("merge resolve error");
+
+		auto intersection = intersect(mapA, mapB);
+		if (intersection.size() != 2 || intersection.at(7) != 70)
+			throw std::exception("intersect error");
+
+		auto diff = difference(mapA, mapB);
+		if (diff.size() != 2 || diff.at(1) != 10 || diff.at(4) != 40)
+			throw std::exception("difference error");
+
+		K joinSum = {};
+		for (auto buckets : join(mapA, mapB))
+			joinSum += buckets.first.value() * buckets.second.value();
+		if (joinSum != (30 * 3 + 70 * 7))
+			throw std::exception("join error");
+
+		// skewed sizes take the galloping path
+		vool::vec_map<K, K> big;
+		for (K key = 0; key < containerSize; ++key)
+			big.insert(key * 2, key);
+		vool::vec_map<K, K> small({ { 1, 0 },{ 42, 0 },{ (containerSize - 1) * 2, 0 } });
+
+		auto skewed = intersect(big, small);
+		if (skewed.size() != 2 || skewed.at(42) != 21)
+			throw std::exception("galloping intersect error");
+
+		if (difference(big, small).size() != containerSize - 2)
+			throw std::exception("galloping difference error");
+	}
+
+	// prefetching traversal and relayout
+	{
+		vool::vec_map<K, V> traversalMap;
+		for (size_t key = containerSize; key > 0; --key)
+		{
+			value.sampleArray[1] = static_cast<V::array_t>(key);
+			traversalMap.insert(key, value);
+		}
+
+		size_t valueSum = 0;
+		traversalMap.for_each_value([&valueSum](const V& v) { valueSum += v.sampleArray[1]; });
+		if (valueSum != (containerSize * (containerSize + 1)) / 2)
+			throw std::exception("for_each_value error");
+
+		traversalMap.relayout();
+		if (!traversalMap.is_sorted())
+			throw std::exception("relayout should sort");
+
+		K lastKey = 0;
+		bool ordered = true;
+		traversalMap.for_each([&lastKey, &ordered](const K key, const V& v)
+		{
+			ordered = ordered && key > lastKey && v.sampleArray[1] == static_cast<V::array_t>(key);
+			lastKey = key;
+		}, 0);
+		if (!ordered || lastKey != containerSize)
+			throw std::exception("relayout lost values");
+	}
+
+	// memory statistics
+	{
+		vool::vec_map<K, V> statsMap;
+		statsMap.reserve(100);
+		for (size_t key = 0; key < 10; ++key)
+			statsMap.insert(key % 8, value); // keys 0 and 1 are inserted twice
+
+		auto stats = statsMap.memory_stats();
+		if (stats.duplicate_count != 2 || stats.sort_count != 0)
+			throw std::exception("memory_stats duplicate count should not sort");
+
+		if (stats.value_heap_bytes != 10 * sizeof(V)
+			|| stats.slack_bytes != 90 * sizeof(vool::vec_map<K, V>::bucket_t))
+			throw std::exception("memory_stats byte count error");
+
+		statsMap.at(3);
+		statsMap.insert(20, value);
+		statsMap.at(20);
+		statsMap.sort();
+
+		stats = statsMap.memory_stats();
+		if (stats.lazy_sort_count != 2 || stats.sort_count != 3 || stats.duplicate_count != 2)
+			throw std::exception("memory_stats sort count error");
+	}
+
+	// hash indexed variant
+	{
+		vool::hash_vec_map<K, V> hashMap;
+		for (size_t key = 0; key < containerSize; ++key)
+			hashMap.insert(key * 3, value);
+
+		if (hashMap.size() != containerSize)
+			throw std::exception("hash_vec_map insert error");
+
+		// buckets keep insertion order
+		if (hashMap.begin()->key() != 0 || (hashMap.end() - 1)->key() != (containerSize - 1) * 3)
+			throw std::exception("hash_vec_map insertion order error");
+
+		hashMap.insert(3, V{});
+		if (hashMap.size() != containerSize || hashMap.at(3).sampleArray[0] != 0)
+			throw std::exception("hash_vec_map insert should replace present keys");
+
+		if (hashMap.find(1) != hashMap.end() || hashMap[6].sampleArray[0] != value.sampleArray[0])
+			throw std::exception("hash_vec_map lookup error");
+
+		for (size_t key = 0; key < containerSize; key += 2)
+			hashMap.erase(key * 3);
+
+		if (hashMap.size() != containerSize / 2)
+			throw std::exception("hash_vec_map erase size error");
+
+		for (size_t key = 0; key < containerSize; ++key)
+			if ((hashMap.find(key * 3) != hashMap.end()) != (key % 2 == 1))
+				throw std::exception("hash_vec_map erase error");
+
+		vool::hash_vec_map<K, K> small({ { 5, 50 },{ 1, 10 },{ 5, 55 } });
+		if (small.size() != 2 || small.at(5) != 55 || small.begin()->key() != 5)
+			throw std::exception("hash_vec_map initializer_list error");
+	}
+
 }
 
 }